@@ -0,0 +1,141 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+// Measures how many SM83 instructions per second the core executes. The workload is a small synthetic ROM, generated
+// on the fly, that mixes ALU work, WRAM loads/stores, CB-prefixed instructions, calls and branches.
+//
+// Usage: ohBoi_cpu_bench [count] [--lcd-off] [--run] [--jit]
+// With --lcd-off the program never turns the LCD on, which takes the Ppu out of the picture and leaves mostly the
+// interpreter itself in the measurement. --run drives the program a frame at a time through run_frame instead of an
+// instruction at a time through step, the count is then of frames. --jit turns the recompiler on, whose code only runs
+// within run_frame, so it implies --run: its emulated speed is the figure to compare with that of --run alone.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Core/Gameboy.h"
+
+namespace {
+    struct Rom_patch {
+        uint16_t addr;
+        std::vector<uint8_t> bytes;
+    };
+
+    const std::vector<Rom_patch> bench_program {
+            {0x0100, {0x00, 0xC3, 0x50, 0x01}},             // nop; jp 0x0150
+            {0x0150, {0x31, 0xFE, 0xFF,                     // ld sp, 0xFFFE
+                      0x3E, 0x91,                           // ld a, 0x91 (patched to 0x11 by --lcd-off)
+                      0xE0, 0x40,                           // ldh (0x40), a
+                      // loop:
+                      0x21, 0x00, 0xC0,                     // ld hl, 0xC000
+                      0x01, 0x00, 0x02,                     // ld bc, 0x0200
+                      // inner:
+                      0x7E,                                 // ld a, (hl)
+                      0x81,                                 // add a, c
+                      0xA8,                                 // xor b
+                      0x07,                                 // rlca
+                      0x22,                                 // ld (hl+), a
+                      0x0B,                                 // dec bc
+                      0x78,                                 // ld a, b
+                      0xB1,                                 // or c
+                      0x20, 0xF6,                           // jr nz, inner
+                      0xCD, 0x6C, 0x01,                     // call sub
+                      0x18, 0xEB,                           // jr loop
+                      // sub:
+                      0x1E, 0x40,                           // ld e, 0x40
+                      // l2:
+                      0xCB, 0x3F,                           // srl a
+                      0xCB, 0x37,                           // swap a
+                      0xCB, 0x5B,                           // bit 3, e
+                      0xCB, 0xC6,                           // set 0, (hl)
+                      0x14,                                 // inc d
+                      0x1D,                                 // dec e
+                      0x20, 0xF4,                           // jr nz, l2
+                      0xC9}}                                // ret
+    };
+
+    constexpr uint16_t lcdc_value_addr = 0x0154;
+
+    std::filesystem::path write_bench_rom(bool lcd_on) {
+        std::vector<uint8_t> rom(0x8000, 0);
+        for ( const auto& patch : bench_program )
+            std::copy(patch.bytes.begin(), patch.bytes.end(), rom.begin() + patch.addr);
+        if ( !lcd_on )
+            rom[lcdc_value_addr] &= 0x7F;
+
+        auto path = std::filesystem::temp_directory_path() / "ohboi_cpu_bench.gb";
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(rom.data()), static_cast<std::streamsize>(rom.size()));
+        return path;
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned long count = 0;
+    bool lcd_on = true;
+    bool run = false;
+    bool jit = false;
+    for ( int i = 1; i < argc; i++ ) {
+        if ( std::string(argv[i]) == "--lcd-off" )
+            lcd_on = false;
+        else if ( std::string(argv[i]) == "--run" )
+            run = true;
+        else if ( std::string(argv[i]) == "--jit" )
+            run = jit = true;
+        else
+            count = std::strtoul(argv[i], nullptr, 10);
+    }
+
+    auto rom_path = write_bench_rom(lcd_on);
+    gb::Gameboy gb(rom_path);
+    if ( jit )
+        gb.toggle_jit();
+    if ( jit && !gb.jit_enabled() )
+        std::cout << "the recompiler is not available in this build" << std::endl;
+
+    if ( run ) {
+        unsigned long frames = count != 0 ? count : 3000;
+        unsigned long long cycles = 0;
+        auto start = std::chrono::steady_clock::now();
+        for ( unsigned long i = 0; i < frames; i++ )
+            cycles += gb.run_frame();
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "frames:          " << frames << "\n"
+                  << "elapsed:         " << elapsed << " s\n"
+                  << "frames/s:        " << static_cast<double>(frames) / elapsed << "\n"
+                  << "emulated speed:  " << (static_cast<double>(cycles) / gb::cpu::clock_speed) / elapsed << "x"
+                  << std::endl;
+        if ( gb.jit_enabled() )
+            std::cout << "native runs:     " << gb.jit_stats().runs << " (" << gb.jit_stats().instructions
+                      << " instructions)" << std::endl;
+        return 0;
+    }
+
+    unsigned long instructions = count != 0 ? count : 20000000;
+    unsigned long long cycles = 0;
+    auto start = std::chrono::steady_clock::now();
+    for ( unsigned long i = 0; i < instructions; i++ ) {
+        gb.step();
+        if ( gb.get_cpu_cycles() >= gb::cpu::clock_speed ) {
+            cycles += gb.get_cpu_cycles();
+            gb.reset_cpu_cycle_counter();
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    cycles += gb.get_cpu_cycles();
+
+    std::cout << "instructions:    " << instructions << "\n"
+              << "elapsed:         " << elapsed << " s\n"
+              << "instructions/s:  " << static_cast<double>(instructions) / elapsed << "\n"
+              << "emulated speed:  " << (static_cast<double>(cycles) / gb::cpu::clock_speed) / elapsed << "x"
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,207 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+// Checks that the recompiler changes nothing but speed: the same program runs on two Gameboys, one with the recompiler
+// on and one without, and every frame both have to save the same state. Exits with 1 if anything differs, or if the
+// recompiler never got to run anything.
+//
+// The workload is a synthetic ROM generated on the fly from a fixed seed: a loop of random register-only instructions
+// (the ones the recompiler translates, and daa, which it doesn't) cut into stretches by stores of A to WRAM, pushes of
+// AF and branches. The timer overflows every 256 cycles and VBlank comes every frame, so interrupts keep landing next
+// to and in the middle of compiled runs, and a direction key held now and then requests the joypad interrupt. Frames
+// are run whole and in odd slices of cycles, at normal, slowed down and sped up speed.
+//
+// Usage: ohBoi_jit_check [frames]
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Core/Gameboy.h"
+
+namespace {
+    const std::vector<uint8_t> vblank_handler {
+            0xF5,                                           // push af
+            0xF0, 0x90,                                     // ldh a, (0x90)
+            0x3C,                                           // inc a
+            0xE0, 0x90,                                     // ldh (0x90), a
+            0xF1,                                           // pop af
+            0xD9                                            // reti
+    };
+
+    const std::vector<uint8_t> timer_handler {
+            0xF5,                                           // push af
+            0xF0, 0x91,                                     // ldh a, (0x91)
+            0xC6, 0x07,                                     // add a, 7
+            0xE0, 0x91,                                     // ldh (0x91), a
+            0xF1,                                           // pop af
+            0xD9                                            // reti
+    };
+
+    const std::vector<uint8_t> joypad_handler {
+            0xF5,                                           // push af
+            0xF0, 0x92,                                     // ldh a, (0x92)
+            0x3C,                                           // inc a
+            0xE0, 0x92,                                     // ldh (0x92), a
+            0xF1,                                           // pop af
+            0xD9                                            // reti
+    };
+
+    const std::vector<uint8_t> setup {
+            0x31, 0xF0, 0xDF,                               // ld sp, 0xDFF0
+            0x3E, 0xF0,                                     // ld a, 0xF0
+            0xE0, 0x06,                                     // ldh (0x06), a (TMA)
+            0x3E, 0x05,                                     // ld a, 0x05
+            0xE0, 0x07,                                     // ldh (0x07), a (TAC)
+            0x3E, 0x20,                                     // ld a, 0x20
+            0xE0, 0x00,                                     // ldh (0x00), a (P1, directions)
+            0x3E, 0x15,                                     // ld a, 0x15
+            0xE0, 0xFF,                                     // ldh (0xFF), a (IE, VBlank, timer and joypad)
+            0x3E, 0x91,                                     // ld a, 0x91
+            0xE0, 0x40,                                     // ldh (0x40), a
+            0xFB                                            // ei
+    };
+
+    // Every register-only instruction but ld sp, nn, which would send the stack anywhere
+    std::vector<uint8_t> register_only_opcodes() {
+        std::vector<uint8_t> ops;
+        for ( unsigned int op = 0x40; op < 0xC0; op++ )
+            if ( op != 0x76 && (op & 7) != 6 && (op >= 0x80 || ((op >> 3) & 7) != 6) )
+                ops.push_back(op);
+        for ( unsigned int op : {0x00, 0x01, 0x11, 0x21, 0x03, 0x13, 0x23, 0x33, 0x0B, 0x1B, 0x2B, 0x3B, 0x09, 0x19,
+                                 0x29, 0x39, 0x04, 0x0C, 0x14, 0x1C, 0x24, 0x2C, 0x3C, 0x05, 0x0D, 0x15, 0x1D, 0x25,
+                                 0x2D, 0x3D, 0x06, 0x0E, 0x16, 0x1E, 0x26, 0x2E, 0x3E, 0x07, 0x0F, 0x17, 0x1F, 0x27,
+                                 0x2F, 0x37, 0x3F, 0xC6, 0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE, 0xCB} )
+            ops.push_back(op);
+        return ops;
+    }
+
+    std::filesystem::path write_check_rom(bool cgb) {
+        std::vector<uint8_t> rom(0x8000, 0);
+        std::copy(vblank_handler.begin(), vblank_handler.end(), rom.begin() + 0x40);
+        std::copy(timer_handler.begin(), timer_handler.end(), rom.begin() + 0x50);
+        std::copy(joypad_handler.begin(), joypad_handler.end(), rom.begin() + 0x60);
+        const uint8_t entry[] {0x00, 0xC3, 0x50, 0x01};   // nop; jp 0x0150
+        std::copy(std::begin(entry), std::end(entry), rom.begin() + 0x100);
+        rom[0x143] = cgb ? 0x80 : 0x00;
+
+        std::vector<uint8_t> code(setup);
+        uint16_t loop = 0x150 + code.size();
+        code.insert(code.end(), {0x31, 0xF0, 0xDF,          // ld sp, 0xDFF0
+                                 0xF0, 0x90});              // ldh a, (0x90)
+        auto ops = register_only_opcodes();
+        std::mt19937 rng(1);
+        for ( unsigned int stretch = 0; stretch < 120; stretch++ ) {
+            for ( unsigned int i = rng() % 40 + 1; i > 0; i-- ) {
+                uint8_t op = ops[rng() % ops.size()];
+                code.push_back(op);
+                if ( op == 0xCB ) {
+                    uint8_t cb_op;
+                    do
+                        cb_op = static_cast<uint8_t>(rng());
+                    while ( (cb_op & 7) == 6 );
+                    code.push_back(cb_op);
+                } else if ( (op & 0xC7) == 0x06 || (op & 0xC7) == 0xC6 ) {
+                    code.push_back(static_cast<uint8_t>(rng()));
+                } else if ( (op & 0xCF) == 0x01 ) {
+                    code.push_back(static_cast<uint8_t>(rng()));
+                    code.push_back(static_cast<uint8_t>(rng()));
+                }
+            }
+            switch ( rng() % 3 ) {
+                case 0:                                     // ld (0xC000 + stretch), a
+                    code.insert(code.end(), {0xEA, static_cast<uint8_t>(stretch), 0xC0});
+                    break;
+                case 1:                                     // push af; pop af
+                    code.insert(code.end(), {0xF5, 0xF1});
+                    break;
+                default:                                    // jr nz, +0
+                    code.insert(code.end(), {0x20, 0x00});
+                    break;
+            }
+        }
+        code.insert(code.end(), {0xC3, static_cast<uint8_t>(loop), static_cast<uint8_t>(loop >> 8)});
+        std::copy(code.begin(), code.end(), rom.begin() + 0x150);
+
+        auto path = std::filesystem::temp_directory_path() / (cgb ? "ohboi_jit_check_cgb.gb" : "ohboi_jit_check.gb");
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(rom.data()), static_cast<std::streamsize>(rom.size()));
+        return path;
+    }
+
+    // Gameboy takes the path by reference and changes its extension to look for the battery save
+    std::unique_ptr<gb::Gameboy> make_gameboy(const std::filesystem::path &rom) {
+        std::filesystem::path path = rom;
+        return std::make_unique<gb::Gameboy>(path);
+    }
+
+    bool check(const std::filesystem::path &rom, unsigned int frames, uint64_t &native_runs) {
+        auto interpreted = make_gameboy(rom), recompiled = make_gameboy(rom);
+        recompiled->toggle_jit();
+
+        std::mt19937 rng(2);
+        for ( unsigned int speed : {10u, 3u, 40u} ) {
+            interpreted->set_speed(speed);
+            recompiled->set_speed(speed);
+            for ( unsigned int i = 0; i < frames; i++ ) {
+                // Every other frame in slices that end in the middle of runs
+                if ( i % 2 == 0 ) {
+                    interpreted->run_frame();
+                    recompiled->run_frame();
+                } else {
+                    for ( unsigned int run = 0; run < 16; run++ ) {
+                        // While it is held the joypad interrupt is requested again after every instruction
+                        if ( run == 4 && i % 6 == 1 ) {
+                            interpreted->press_key(Joypad::KEY_RIGHT);
+                            recompiled->press_key(Joypad::KEY_RIGHT);
+                        } else if ( run == 5 ) {
+                            interpreted->release_key(Joypad::KEY_RIGHT);
+                            recompiled->release_key(Joypad::KEY_RIGHT);
+                        }
+                        unsigned int cycles = rng() % 8000 + 1;
+                        interpreted->run_cycles(cycles);
+                        recompiled->run_cycles(cycles);
+                    }
+                }
+                if ( recompiled->save_state() != interpreted->save_state() ) {
+                    std::cout << "speed " << speed << ": state differs at frame " << i << std::endl;
+                    return false;
+                }
+            }
+        }
+        native_runs += recompiled->jit_stats().runs;
+        std::cout << "native runs:     " << recompiled->jit_stats().runs << " ("
+                  << recompiled->jit_stats().instructions << " instructions)" << std::endl;
+        return true;
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned int frames = argc > 1 ? static_cast<unsigned int>(std::strtoul(argv[1], nullptr, 10)) : 120;
+
+    auto probe = make_gameboy(write_check_rom(false));
+    probe->toggle_jit();
+    if ( !probe->jit_enabled() ) {
+        std::cout << "the recompiler is not available in this build, nothing to check" << std::endl;
+        return 0;
+    }
+
+    bool ok = true;
+    uint64_t native_runs = 0;
+    for ( bool cgb : {false, true} ) {
+        std::cout << (cgb ? "CGB" : "DMG") << std::endl;
+        ok = check(write_check_rom(cgb), frames, native_runs) && ok;
+    }
+    if ( ok && native_runs == 0 ) {
+        std::cout << "the recompiler never ran anything" << std::endl;
+        ok = false;
+    }
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
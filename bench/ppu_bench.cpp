@@ -0,0 +1,114 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+// Measures how many dots per second the Ppu renders. The workload is a small synthetic ROM, generated on the fly, that
+// fills VRAM with a pattern, lays out 40 sprites diagonally down the screen (two or three on every line), turns the
+// LCD on and halts with every interrupt disabled: from then on the Cpu skips straight from one Ppu event to the next,
+// so nearly all the time goes into drawing.
+//
+// Usage: ohBoi_ppu_bench [frames] [--bg-only]
+// Lines with sprites go through the pixel FIFO and fetcher dot by dot. --bg-only leaves sprites off, which lets every
+// line be drawn whole instead.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Core/Gameboy.h"
+
+namespace {
+    struct Rom_patch {
+        uint16_t addr;
+        std::vector<uint8_t> bytes;
+    };
+
+    const std::vector<Rom_patch> bench_program {
+            {0x0100, {0x00, 0xC3, 0x50, 0x01}},             // nop; jp 0x0150
+            {0x0150, {0x31, 0xFE, 0xFF,                     // ld sp, 0xFFFE
+                      0xAF,                                 // xor a
+                      0xE0, 0x40,                           // ldh (0x40), a
+                      0x21, 0x00, 0x80,                     // ld hl, 0x8000
+                      // fill:
+                      0x7D,                                 // ld a, l
+                      0xAC,                                 // xor h
+                      0x22,                                 // ld (hl+), a
+                      0x7C,                                 // ld a, h
+                      0xFE, 0xA0,                           // cp 0xA0
+                      0x20, 0xF8,                           // jr nz, fill
+                      0x21, 0x00, 0xFE,                     // ld hl, 0xFE00
+                      0x0E, 0x28,                           // ld c, 40
+                      0x06, 0x10,                           // ld b, 16
+                      // oam:
+                      0x78,                                 // ld a, b
+                      0x22,                                 // ld (hl+), a (y)
+                      0x22,                                 // ld (hl+), a (x)
+                      0x22,                                 // ld (hl+), a (tile)
+                      0xAF,                                 // xor a
+                      0x22,                                 // ld (hl+), a (attributes)
+                      0x78,                                 // ld a, b
+                      0xC6, 0x04,                           // add a, 4
+                      0x47,                                 // ld b, a
+                      0x0D,                                 // dec c
+                      0x20, 0xF3,                           // jr nz, oam
+                      0x3E, 0xE4,                           // ld a, 0xE4
+                      0xE0, 0x47,                           // ldh (0x47), a
+                      0xE0, 0x48,                           // ldh (0x48), a
+                      0xE0, 0x49,                           // ldh (0x49), a
+                      0x3E, 0x93,                           // ld a, 0x93 (patched to 0x91 by --bg-only)
+                      0xE0, 0x40,                           // ldh (0x40), a
+                      0xF3,                                 // di
+                      0x76,                                 // halt
+                      0x18, 0xFD}}                          // jr halt
+    };
+
+    constexpr uint16_t lcdc_value_addr = 0x017E;
+
+    std::filesystem::path write_bench_rom(bool sprites) {
+        std::vector<uint8_t> rom(0x8000, 0);
+        for ( const auto& patch : bench_program )
+            std::copy(patch.bytes.begin(), patch.bytes.end(), rom.begin() + patch.addr);
+        if ( !sprites )
+            rom[lcdc_value_addr] &= 0xFD;
+
+        auto path = std::filesystem::temp_directory_path() / "ohboi_ppu_bench.gb";
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(rom.data()), static_cast<std::streamsize>(rom.size()));
+        return path;
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned long frames = 2000;
+    bool sprites = true;
+    for ( int i = 1; i < argc; i++ ) {
+        if ( std::string(argv[i]) == "--bg-only" )
+            sprites = false;
+        else
+            frames = std::strtoul(argv[i], nullptr, 10);
+    }
+
+    auto rom_path = write_bench_rom(sprites);
+    gb::Gameboy gb(rom_path);
+    // Gets the setup out of the way, up to the first frame drawn with the LCD on
+    for ( int i = 0; i < 3; i++ )
+        gb.run_frame();
+
+    auto start = std::chrono::steady_clock::now();
+    for ( unsigned long i = 0; i < frames; i++ )
+        gb.run_frame();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double dots = static_cast<double>(frames) * gb::Gameboy::frame_cycles;
+    std::cout << "frames:          " << frames << "\n"
+              << "elapsed:         " << elapsed << " s\n"
+              << "dots/s:          " << dots / elapsed << "\n"
+              << "frames/s:        " << static_cast<double>(frames) / elapsed << "\n"
+              << "emulated speed:  " << (dots / gb::cpu::clock_speed) / elapsed << "x" << std::endl;
+    return 0;
+}
@@ -0,0 +1,248 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+// Checks that save states capture the whole machine: a state saved at any point, loaded into another Gameboy, has to
+// carry on exactly like the original, down to the screen, the samples and the next state saved. Rewinding and running
+// ahead are built on that and get checked the same way, along with slowed down speeds still reaching VBlank. Exits with
+// 1 if anything differs.
+//
+// The workload is a small synthetic ROM, generated on the fly, that keeps every component busy: it scrolls the
+// background from the VBlank interrupt, moves it vertically from the timer interrupt, has sprites on screen, retriggers
+// a square channel every frame and halts in between.
+//
+// Usage: ohBoi_state_check [rom]
+// With a ROM given, that is used instead, on whatever hardware model it asks for.
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Core/Gameboy.h"
+#include "Core/Rewind.h"
+#include "Core/Run_ahead.h"
+
+namespace {
+    struct Rom_patch {
+        uint16_t addr;
+        std::vector<uint8_t> bytes;
+    };
+
+    const std::vector<Rom_patch> check_program {
+            {0x0040, {0xF5,                                 // push af
+                      0xF0, 0x90,                           // ldh a, (0x90)
+                      0x3C,                                 // inc a
+                      0xE0, 0x90,                           // ldh (0x90), a
+                      0xE0, 0x43,                           // ldh (0x43), a (SCX)
+                      0x3E, 0x87,                           // ld a, 0x87
+                      0xE0, 0x19,                           // ldh (0x19), a (NR24, trigger)
+                      0xF1,                                 // pop af
+                      0xD9}},                               // reti
+            {0x0050, {0xF5,                                 // push af
+                      0xF0, 0x91,                           // ldh a, (0x91)
+                      0x3C,                                 // inc a
+                      0xE0, 0x91,                           // ldh (0x91), a
+                      0xE0, 0x42,                           // ldh (0x42), a (SCY)
+                      0xF1,                                 // pop af
+                      0xD9}},                               // reti
+            {0x0100, {0x00, 0xC3, 0x50, 0x01}},             // nop; jp 0x0150
+            {0x0150, {0x31, 0xFE, 0xFF,                     // ld sp, 0xFFFE
+                      0xAF,                                 // xor a
+                      0xE0, 0x40,                           // ldh (0x40), a
+                      0x21, 0x00, 0x80,                     // ld hl, 0x8000
+                      // fill:
+                      0x7D,                                 // ld a, l
+                      0xAC,                                 // xor h
+                      0x22,                                 // ld (hl+), a
+                      0x7C,                                 // ld a, h
+                      0xFE, 0xA0,                           // cp 0xA0
+                      0x20, 0xF8,                           // jr nz, fill
+                      0x21, 0x00, 0xFE,                     // ld hl, 0xFE00
+                      0x0E, 0x0A,                           // ld c, 10
+                      0x06, 0x10,                           // ld b, 16
+                      // oam:
+                      0x78,                                 // ld a, b
+                      0x22,                                 // ld (hl+), a (y)
+                      0x22,                                 // ld (hl+), a (x)
+                      0x22,                                 // ld (hl+), a (tile)
+                      0xAF,                                 // xor a
+                      0x22,                                 // ld (hl+), a (attributes)
+                      0x78,                                 // ld a, b
+                      0xC6, 0x0C,                           // add a, 12
+                      0x47,                                 // ld b, a
+                      0x0D,                                 // dec c
+                      0x20, 0xF3,                           // jr nz, oam
+                      0x3E, 0xE4,                           // ld a, 0xE4
+                      0xE0, 0x47,                           // ldh (0x47), a
+                      0xE0, 0x48,                           // ldh (0x48), a
+                      0xE0, 0x49,                           // ldh (0x49), a
+                      0x3E, 0x80,                           // ld a, 0x80
+                      0xE0, 0x26,                           // ldh (0x26), a (NR52)
+                      0x3E, 0x77,                           // ld a, 0x77
+                      0xE0, 0x24,                           // ldh (0x24), a (NR50)
+                      0x3E, 0xFF,                           // ld a, 0xFF
+                      0xE0, 0x25,                           // ldh (0x25), a (NR51)
+                      0x3E, 0x80,                           // ld a, 0x80
+                      0xE0, 0x16,                           // ldh (0x16), a (NR21)
+                      0x3E, 0xF3,                           // ld a, 0xF3
+                      0xE0, 0x17,                           // ldh (0x17), a (NR22)
+                      0x3E, 0x05,                           // ld a, 0x05
+                      0xE0, 0x07,                           // ldh (0x07), a (TAC)
+                      0xE0, 0xFF,                           // ldh (0xFF), a (IE, VBlank and timer)
+                      0x3E, 0x93,                           // ld a, 0x93
+                      0xE0, 0x40,                           // ldh (0x40), a
+                      0xFB,                                 // ei
+                      // loop:
+                      0xF0, 0x91,                           // ldh a, (0x91)
+                      0xE0, 0x18,                           // ldh (0x18), a (NR23)
+                      0x76,                                 // halt
+                      0x18, 0xF9}}                          // jr loop
+    };
+
+    std::filesystem::path write_check_rom(bool cgb) {
+        std::vector<uint8_t> rom(0x8000, 0);
+        for ( const auto& patch : check_program )
+            std::copy(patch.bytes.begin(), patch.bytes.end(), rom.begin() + patch.addr);
+        rom[0x143] = cgb ? 0x80 : 0x00;
+
+        auto path = std::filesystem::temp_directory_path() / (cgb ? "ohboi_state_check_cgb.gb" : "ohboi_state_check.gb");
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(rom.data()), static_cast<std::streamsize>(rom.size()));
+        return path;
+    }
+
+    constexpr size_t screen_bytes = 160 * 144 * sizeof(uint32_t);
+
+    // Gameboy takes the path by reference and changes its extension to look for the battery save
+    std::unique_ptr<gb::Gameboy> make_gameboy(const std::filesystem::path &rom) {
+        std::filesystem::path path = rom;
+        return std::make_unique<gb::Gameboy>(path);
+    }
+
+    std::vector<float> take_audio(gb::Gameboy &gb) {
+        std::vector<float> samples = gb.get_audio_output();
+        gb.set_audio_reproduced();
+        return samples;
+    }
+
+    bool fail(const std::string &check, const std::string &what) {
+        std::cout << check << ": " << what << std::endl;
+        return false;
+    }
+
+    // Saves at the given number of Cpu cycles into a run, then runs the original and a copy loaded from the state side
+    // by side for a few frames
+    bool check_round_trip(const std::filesystem::path &rom, unsigned int warmup_frames, unsigned int cycles) {
+        std::string check = "round trip at " + std::to_string(cycles) + " cycles";
+        auto original = make_gameboy(rom);
+        for ( unsigned int i = 0; i < warmup_frames; i++ )
+            original->run_frame();
+        original->run_cycles(cycles);
+        take_audio(*original);
+
+        auto state = original->save_state();
+        auto copy = make_gameboy(rom);
+        if ( !copy->load_state(state) )
+            return fail(check, "state refused");
+        if ( copy->save_state() != state )
+            return fail(check, "state saved back after loading differs");
+        if ( std::memcmp(copy->last_frame(), original->last_frame(), screen_bytes) != 0 )
+            return fail(check, "last frame differs after loading");
+
+        for ( int frame = 0; frame < 3; frame++ ) {
+            original->run_frame();
+            copy->run_frame();
+            if ( std::memcmp(copy->last_frame(), original->last_frame(), screen_bytes) != 0 )
+                return fail(check, "screen differs " + std::to_string(frame + 1) + " frames later");
+            if ( take_audio(*copy) != take_audio(*original) )
+                return fail(check, "samples differ " + std::to_string(frame + 1) + " frames later");
+            if ( copy->save_state() != original->save_state() )
+                return fail(check, "state differs " + std::to_string(frame + 1) + " frames later");
+        }
+        return true;
+    }
+
+    // Every state rewound to has to be the one captured at that frame
+    bool check_rewind(const std::filesystem::path &rom, unsigned int frames) {
+        auto gb = make_gameboy(rom);
+        gb::Rewind_buffer rewind(64 << 20, 16);
+        std::vector<std::vector<uint8_t>> states;
+        for ( unsigned int i = 0; i < frames; i++ ) {
+            gb->run_frame();
+            states.push_back(gb->save_state());
+            rewind.capture(*gb);
+        }
+        for ( unsigned int i = frames; i-- > 0; ) {
+            if ( !rewind.rewind(*gb) )
+                return fail("rewind", "history ran out at frame " + std::to_string(i));
+            if ( gb->save_state() != states[i] )
+                return fail("rewind", "state differs at frame " + std::to_string(i));
+        }
+        if ( rewind.rewind(*gb) )
+            return fail("rewind", "history longer than the frames captured");
+        return true;
+    }
+
+    // Running ahead must leave the real frames, their screen, samples and states, as they would be without it
+    bool check_run_ahead(const std::filesystem::path &rom, unsigned int frames, unsigned int ahead) {
+        std::string check = "run ahead by " + std::to_string(ahead);
+        auto plain = make_gameboy(rom), with_run_ahead = make_gameboy(rom);
+        gb::Run_ahead run_ahead(ahead);
+        for ( unsigned int i = 0; i < frames; i++ ) {
+            plain->run_frame();
+            run_ahead.run_frame(*with_run_ahead);
+            if ( run_ahead.audio() != take_audio(*plain) )
+                return fail(check, "samples differ at frame " + std::to_string(i));
+            if ( std::memcmp(with_run_ahead->last_frame(), plain->last_frame(), screen_bytes) != 0 )
+                return fail(check, "screen differs at frame " + std::to_string(i));
+            if ( with_run_ahead->save_state() != plain->save_state() )
+                return fail(check, "state differs at frame " + std::to_string(i));
+        }
+        return true;
+    }
+
+    // Below normal speed a clock can be worth less than a cycle of the master timeline, frames must still end
+    bool check_slow_speed(const std::filesystem::path &rom, unsigned int warmup_frames) {
+        auto gb = make_gameboy(rom);
+        for ( unsigned int i = 0; i < warmup_frames; i++ )
+            gb->run_frame();
+        for ( unsigned int speed : {1u, 3u, 7u} ) {
+            gb->set_speed(speed);
+            for ( int i = 0; i < 3; i++ ) {
+                gb->run_frame();
+                if ( !gb->frame_ready() )
+                    return fail("speed " + std::to_string(speed), "frame ended before VBlank");
+            }
+        }
+        return true;
+    }
+
+    bool check_all(const std::filesystem::path &rom) {
+        bool ok = true;
+        for ( unsigned int cycles : {0u, 1000u, 17000u, 30000u, 52000u, 69000u} )
+            ok = check_round_trip(rom, 30, cycles) && ok;
+        ok = check_rewind(rom, 90) && ok;
+        for ( unsigned int ahead : {1u, 2u} )
+            ok = check_run_ahead(rom, 60, ahead) && ok;
+        ok = check_slow_speed(rom, 30) && ok;
+        return ok;
+    }
+}
+
+int main(int argc, char **argv) {
+    bool ok = true;
+    if ( argc > 1 ) {
+        ok = check_all(argv[1]);
+    } else {
+        for ( bool cgb : {false, true} ) {
+            std::cout << (cgb ? "CGB" : "DMG") << std::endl;
+            ok = check_all(write_check_rom(cgb)) && ok;
+        }
+    }
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
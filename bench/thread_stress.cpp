@@ -0,0 +1,126 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+// Hammers the two lock-free handoffs between threads, Sample_ring (emulation to audio device) and Triple_buffer
+// (emulation to display), with a producer and a consumer thread going as fast as they can, and checks that nothing is
+// lost, duplicated, reordered or torn on the way. Exits with 1 on the first problem found.
+//
+// Usage: ohBoi_thread_stress [samples] [frames]
+// Configure with -DCMAKE_CXX_FLAGS=-fsanitize=thread to run it under ThreadSanitizer as well.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Core/Audio/Sample_ring.h"
+#include "Core/Triple_buffer.h"
+
+namespace {
+    // Small enough for the ring to be full and empty all the time, odd chunk sizes make every position wrap around
+    constexpr size_t ring_capacity = 1024;
+    constexpr size_t max_chunk = 700;
+
+    // Samples are their own index: floats hold integers exactly up to 2^24
+    bool stress_ring(uint32_t samples) {
+        gb::Sample_ring ring(ring_capacity);
+
+        std::thread producer([&ring, samples] {
+            std::minstd_rand rng(1);
+            std::vector<float> chunk(max_chunk);
+            for ( uint32_t next = 0; next < samples; ) {
+                size_t count = std::min<size_t>(rng() % max_chunk + 1, samples - next);
+                for ( size_t i = 0; i < count; i++ )
+                    chunk[i] = static_cast<float>(next + i);
+                size_t written = ring.write(chunk.data(), count);
+                // Spinning without yielding would starve the other side on a single core
+                if ( written == 0 )
+                    std::this_thread::yield();
+                next += written;
+            }
+        });
+
+        std::minstd_rand rng(2);
+        std::vector<float> chunk(max_chunk);
+        uint32_t expected = 0;
+        size_t empty_reads = 0;
+        bool ok = true;
+        while ( expected < samples && ok ) {
+            size_t read = ring.read(chunk.data(), rng() % max_chunk + 1);
+            if ( read == 0 ) {
+                empty_reads++;
+                std::this_thread::yield();
+            }
+            for ( size_t i = 0; i < read && ok; i++, expected++ ) {
+                if ( chunk[i] != static_cast<float>(expected) ) {
+                    std::cout << "ring: sample " << expected << " read as " << chunk[i] << std::endl;
+                    ok = false;
+                }
+            }
+        }
+        producer.join();
+        if ( ok && ring.size() != 0 ) {
+            std::cout << "ring: " << ring.size() << " samples left over" << std::endl;
+            ok = false;
+        }
+        std::cout << "ring samples:    " << expected << " (" << empty_reads << " empty reads)" << std::endl;
+        return ok;
+    }
+
+    using Frame = std::array<uint64_t, 4096>;
+
+    // Every frame is filled with its own number, a frame mixing two numbers was read while being written
+    bool stress_triple_buffer(uint64_t frames) {
+        gb::Triple_buffer<Frame> buffer;
+
+        std::thread producer([&buffer, frames] {
+            for ( uint64_t n = 1; n <= frames; n++ ) {
+                buffer.back().fill(n);
+                buffer.publish();
+            }
+        });
+
+        uint64_t last = 0, acquired = 0;
+        bool ok = true;
+        while ( last < frames && ok ) {
+            if ( !buffer.acquire() ) {
+                std::this_thread::yield();
+                continue;
+            }
+            acquired++;
+            const Frame &frame = buffer.front();
+            uint64_t n = frame[0];
+            if ( std::any_of(frame.begin(), frame.end(), [n](uint64_t v) { return v != n; }) ) {
+                std::cout << "triple buffer: frame " << n << " torn" << std::endl;
+                ok = false;
+            } else if ( n <= last ) {
+                std::cout << "triple buffer: frame " << n << " after " << last << std::endl;
+                ok = false;
+            } else if ( buffer.front_sequence() != n ) {
+                std::cout << "triple buffer: frame " << n << " numbered " << buffer.front_sequence() << std::endl;
+                ok = false;
+            }
+            last = n;
+        }
+        producer.join();
+        std::cout << "frames:          " << frames << " published, " << acquired << " acquired" << std::endl;
+        return ok;
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t samples = argc > 1 ? static_cast<uint32_t>(std::strtoul(argv[1], nullptr, 10)) : 3000000;
+    uint64_t frames = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 200000;
+    // Past 2^24 consecutive integers stop being representable as floats
+    samples = std::min<uint32_t>(samples, 1 << 24);
+
+    bool ok = stress_ring(samples);
+    ok = stress_triple_buffer(frames) && ok;
+    std::cout << (ok ? "ok" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
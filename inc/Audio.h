@@ -5,28 +5,49 @@
 #ifndef OHBOI_AUDIO_H
 #define OHBOI_AUDIO_H
 
-#include <Core/Audio/apu.h>
+#include <Core/Audio/Sample_ring.h>
 #include <SDL2/SDL_audio.h>
-#include <vector>
+#include <atomic>
+#include <cstdint>
 
-#define SAMPLE_SIZE 2048
+// Frames the device asks for at each callback
+#define SAMPLE_SIZE 1024
 
+/* The device pulls samples from a ring the emulation pushes into, from its own thread. Pushing only waits when the
+ * ring is full, which shouldn't happen as long as the emulation produces samples at producer_rate(), and never for
+ * longer than a few callbacks. Without a device, samples are discarded. */
 class Audio {
 public:
     Audio();
     ~Audio();
 
-    void update(const apu::audio_output& a);
+    // Queues frames of interleaved left/right samples, as the apu produces them
+    void push(const float *samples, size_t frames);
+
+    // How full the ring is, from 0 to 1
+    [[nodiscard]] double fill() const { return ring.fill(); }
+    // Samples per second the device plays
+    [[nodiscard]] double rate() const { return device_rate; }
+    /* Samples per second the emulation should produce to keep the ring half full: the device's rate, nudged up while
+     * the ring is emptier than that and down while it's fuller. The host and device clocks never quite agree with
+     * each other or with the emulated one, this absorbs the difference without the pitch change being audible. */
+    [[nodiscard]] double producer_rate() const { return device_rate * (1.0 + max_rate_delta * (1.0 - 2.0 * fill())); }
+    // Callbacks that ran out of samples and had to play silence
+    [[nodiscard]] uint64_t underruns() const { return underrun_count.load(std::memory_order_relaxed); }
 
     void reset() {
         SDL_PauseAudioDevice(dev, 0);
-
-        buffer_index = 0;
-        std::fill(buffer.begin(), buffer.end(), 0);
     };
 private:
+    static constexpr double max_rate_delta = 0.005;
+    // Callback periods push waits on a full ring before dropping samples
+    static constexpr double max_full_callbacks = 4;
+
     SDL_AudioDeviceID dev;
-    std::vector<float> buffer;
-    int buffer_index;
+    double device_rate;
+    gb::Sample_ring ring;
+    std::atomic<uint64_t> underrun_count;
+
+    static void callback(void *userdata, Uint8 *stream, int len);
 };
 #endif //OHBOI_AUDIO_H
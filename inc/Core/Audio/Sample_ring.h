@@ -0,0 +1,75 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_SAMPLE_RING_H
+#define OHBOI_SAMPLE_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+namespace gb {
+    /* Lock-free queue of samples between exactly one producer thread (the emulation) and one consumer thread (the audio
+     * device callback). Each side owns one of the two positions and only reads the other, so a write and a read can
+     * happen at the same time without locking: the producer publishes samples with a release store of the head once
+     * they're in place, and the consumer frees space the same way with the tail. Positions grow forever and are masked
+     * into the buffer, whose size is a power of two. */
+    class Sample_ring {
+    public:
+        // Capacity is rounded up to a power of two
+        explicit Sample_ring(size_t capacity) : buffer_(std::bit_ceil(std::max<size_t>(capacity, 2))),
+                                                mask_(buffer_.size() - 1), head_(0), tail_(0) {}
+
+        // Producer side: copies as many samples as fit, returns how many that was
+        size_t write(const float *samples, size_t count) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            size_t tail = tail_.load(std::memory_order_acquire);
+            count = std::min(count, buffer_.size() - (head - tail));
+            copy_in(head, samples, count);
+            head_.store(head + count, std::memory_order_release);
+            return count;
+        }
+
+        // Consumer side: copies out as many samples as are available, up to count, returns how many that was
+        size_t read(float *out, size_t count) {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            size_t head = head_.load(std::memory_order_acquire);
+            count = std::min(count, head - tail);
+            copy_out(tail, out, count);
+            tail_.store(tail + count, std::memory_order_release);
+            return count;
+        }
+
+        // Either side, only exact from the producer's (lower bound) or the consumer's (upper bound) point of view
+        [[nodiscard]] size_t size() const {
+            return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+        }
+        [[nodiscard]] size_t capacity() const { return buffer_.size(); }
+        // From 0 (empty) to 1 (full)
+        [[nodiscard]] double fill() const { return static_cast<double>(size()) / static_cast<double>(capacity()); }
+    private:
+        std::vector<float> buffer_;
+        size_t mask_;
+
+        // Kept on separate cache lines, each is written by a different thread
+        alignas(64) std::atomic<size_t> head_;
+        alignas(64) std::atomic<size_t> tail_;
+
+        void copy_in(size_t pos, const float *samples, size_t count) {
+            size_t first = std::min(count, buffer_.size() - (pos & mask_));
+            std::copy_n(samples, first, buffer_.begin() + static_cast<ptrdiff_t>(pos & mask_));
+            std::copy_n(samples + first, count - first, buffer_.begin());
+        }
+
+        void copy_out(size_t pos, float *out, size_t count) const {
+            size_t first = std::min(count, buffer_.size() - (pos & mask_));
+            std::copy_n(buffer_.begin() + static_cast<ptrdiff_t>(pos & mask_), first, out);
+            std::copy_n(buffer_.begin(), count - first, out + first);
+        }
+    };
+}
+
+#endif //OHBOI_SAMPLE_RING_H
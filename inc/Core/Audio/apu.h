@@ -10,46 +10,59 @@
 
 #include <cstdint>
 #include <memory>
+#include <vector>
 #include "audio_ch_1.h"
 #include "audio_ch_2.h"
 #include "noise_ch.h"
 #include "wave_ch.h"
+#include "Core/Scheduler.h"
+#include "Core/Savestate.h"
 
 class apu {
 public:
-    struct audio_output {
-        int ch1_output;
-        int ch2_output;
-        int wave_output;
-        int noise_output;
-
-        int ch1_output_right;
-        int ch2_output_right;
-        int wave_output_right;
-        int noise_output_right;
-
-        int left_volume;
-        int right_volume;
-    };
-
-    apu();
+    /* Output is mixed down to interleaved left/right float samples, ready to be handed to the audio device as it is.
+     * Each channel contributes up to 0.15 to the side it's routed to, scaled by that side's master volume. */
+    static constexpr unsigned int output_channels = 2;
+
+    explicit apu(gb::Scheduler &scheduler);
     ~apu() = default;
 
     void send(uint16_t addr, uint8_t val);
-    [[nodiscard]] uint8_t read(uint16_t addr) const;
-    void step(int cycles);
+    [[nodiscard]] uint8_t read(uint16_t addr);
+
+    // Runs the channels up to time, producing the samples that fall in between
+    void sync(uint64_t time);
+    void sync() { sync(scheduler_.now()); }
+    void frame_sequencer_event(uint64_t time);
+    // Keeps the output sample rate steady when the emulation runs faster or slower than real time
+    void set_speed(unsigned int multiplier);
+    /* Samples per second of emulated time. Doesn't have to be a whole number of cycles per sample: frontends nudge it
+     * continuously to match how fast the audio device actually drains what they queue. */
+    void set_sample_rate(double rate);
+    [[nodiscard]] double sample_rate() const { return sample_rate_; }
 
     void toggle_ch1();
     void toggle_ch2();
     void toggle_wave();
     void toggle_noise();
 
-    [[nodiscard]] const audio_output& get_audio_output() const;
+    // Samples produced since the last set_reproduced, the channels are caught up first
+    [[nodiscard]] const std::vector<float>& get_audio_output();
 
-    [[nodiscard]] bool new_audio_available() const;
+    [[nodiscard]] bool new_audio_available();
     void set_reproduced();
+
+    // Samples not played yet, the sample rate and the channel toggles belong to the frontend and stay as they are
+    void save_state(gb::State_writer &out) const;
+    void load_state(gb::State_reader &in);
 private:
-    bool new_audio;
+    gb::Scheduler &scheduler_;
+    uint64_t synced_;
+    double sample_rate_;
+    unsigned int speed_multiplier_;
+    // Cycles between two samples, as a 32.32 fixed point number
+    uint64_t downsample_period;
+
 
     union {
         struct {
@@ -89,10 +102,13 @@ private:
 
     int frame_sequence_counter;
     int downsample_count;
+    // Fractions of a cycle the samples taken so far are late by, in 1/2^32ths
+    uint32_t downsample_fraction;
     uint8_t frame_sequencer;
 
-    apu::audio_output mAudioOutput;
+    std::vector<float> audio_samples;
 
+    // Saved whole, padding included: their constructors clear them so that machines in the same state save the same bytes
     audio_ch_1 ch1;
     audio_ch_2 ch2;
     wave_ch wave;
@@ -104,6 +120,10 @@ private:
     bool noise_enabled;
 
     void reset();
+    void update_downsample_period();
+    void step(uint64_t cycles);
+    void clock_frame_sequencer();
+    void schedule_events();
 };
 
 
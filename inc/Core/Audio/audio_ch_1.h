@@ -19,7 +19,8 @@ public:
     [[nodiscard]] uint8_t get_output() const;
 
     bool is_running() const;
-    void step();
+    // Same as stepping cycles times one by one
+    void step(int cycles);
     void update_envelope();
     void update_length();
     void update_sweep();
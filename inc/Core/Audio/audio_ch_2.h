@@ -14,7 +14,8 @@ public:
 
     [[nodiscard]] uint8_t read(uint8_t reg) const;
     void write(uint8_t reg, uint8_t val);
-    void step();
+    // Same as stepping cycles times one by one
+    void step(int cycles);
     [[nodiscard]] uint8_t get_output() const;
     [[nodiscard]] bool is_running() const;
     void update_length();
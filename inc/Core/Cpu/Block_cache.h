@@ -0,0 +1,73 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_BLOCK_CACHE_H
+#define OHBOI_BLOCK_CACHE_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace gb::cpu {
+    union Instr_argument {
+        struct {
+            uint8_t lsb;
+            uint8_t msb;
+        };
+        uint16_t word;
+    };
+
+    /* Straight-line runs of instructions decoded once and replayed by Cpu::fetch. A block starts at a jump target and
+     * ends after the first instruction that can change the flow of execution, or at the end of its 256-byte page, so
+     * that invalidating a page of RAM always takes whole blocks with it.
+     *
+     * Blocks are keyed by (bank, pc): the bank is the ROM bank mapped at pc for cartridge code, the WRAM bank for code
+     * in 0xD000-0xDFFF and 0 everywhere else. Code running from RAM registers its physical page with the cache, and
+     * Memory reports writes to those pages so that the blocks they overlap get dropped. */
+    class Block_cache {
+    public:
+        struct Instruction {
+            uint16_t addr;
+            uint8_t opcode;
+            uint8_t length;
+            uint8_t cycles;
+            // Instructions from this one on the recompiler can translate in one go, see Jit, 0 when it can't this one
+            uint8_t run_length;
+            Instr_argument arg;
+        };
+
+        struct Block {
+            unsigned int id;
+            uint16_t start;
+            uint16_t end;
+            unsigned int cycles;
+            std::vector<Instruction> instructions;
+            // LY, STAT, DIV or TIMA when the block is a loop onto itself that only polls that register, 0 otherwise
+            uint16_t polled_register;
+        };
+
+        static uint32_t key(unsigned int bank, uint16_t pc) { return (bank << 16) | pc; }
+
+        const Block *find(uint32_t key) const {
+            auto it = blocks_.find(key);
+            return it != blocks_.end() ? &it->second : nullptr;
+        }
+        // Stores the block under a fresh id, so that anything derived from a block replaced at the same key can tell
+        const Block *insert(uint32_t key, Block block, int ram_page);
+
+        // Drops every block of the given RAM page that covers offset, returns whether the page still holds code
+        bool invalidate(int ram_page, uint8_t offset);
+        void clear();
+        // Drops every block decoded from RAM, keeping the ones from ROM
+        void clear_ram();
+
+        [[nodiscard]] size_t size() const { return blocks_.size(); }
+    private:
+        std::unordered_map<uint32_t, Block> blocks_;
+        std::unordered_map<int, std::vector<uint32_t>> ram_pages_;
+        unsigned int next_id_ = 1;
+    };
+}
+
+#endif //OHBOI_BLOCK_CACHE_H
@@ -6,13 +6,18 @@
 #define OHBOI_CPU_H
 
 
+#include <array>
+#include <bitset>
 #include <vector>
 #include <memory>
-#include <iostream>
+#include <utility>
 
+#include "Block_cache.h"
+#include "Jit.h"
 #include "Registers.h"
 #include "Interrupts.h"
 #include "Core/Joypad.h"
+#include "Core/Savestate.h"
 
 namespace gb {
     class Gameboy;
@@ -20,6 +25,9 @@ namespace gb {
 
 namespace gb::cpu {
     const unsigned int clock_speed = 4194304;
+    // Longest stretch of HALT or of a polling loop skipped in one step, a scanline, so that whoever counts cycles per
+    // frame doesn't overshoot
+    const unsigned int max_idle_skip = 456;
     const int timer_ctr_reset_values[4] {
             1024, 16, 64, 256
     };
@@ -29,33 +37,68 @@ namespace gb::cpu {
         uint8_t n_cycles;
     };
 
-    union Instr_argument;
-
     class Cpu {
     public:
         Cpu(Gameboy &gb, std::shared_ptr<Interrupts> interrupts, std::shared_ptr<Joypad> joypad);
-        ~Cpu() { std::cout << "Cpu destroyed" << std::endl; }
+        ~Cpu() = default;
         void step();
+        /* Same as step, except that where the recompiler has the run of instructions at pc compiled, and going through
+         * it takes no more than max_cycles and ends before the given time, the whole run goes in one step */
+        void step(unsigned int max_cycles, uint64_t until);
+
+        struct Idle_loop_stats {
+            uint64_t hits;          // Times a polling loop was skipped
+            uint64_t cycles;        // Cycles skipped in total
+        };
+        [[nodiscard]] const Idle_loop_stats &idle_loop_stats() const { return idle_loop_stats_; }
+
+        struct Jit_stats {
+            uint64_t runs;          // Compiled runs executed
+            uint64_t instructions;  // Instructions they went through
+        };
+        [[nodiscard]] const Jit_stats &jit_stats() const { return jit_stats_; }
 
         [[nodiscard]] unsigned int get_cycles() const { return cycles_; }
-        [[nodiscard]] uint8_t get_div_reg() const { return div_reg_; }
+        [[nodiscard]] uint8_t get_div_reg() { sync_timers(); return div_reg_; }
         [[nodiscard]] uint8_t get_tac() const { return ((uint8_t) tac_.to_ulong() & 0xFF) | 0xF8; }
-        [[nodiscard]] uint8_t get_tima() const { return tima_; }
+        [[nodiscard]] uint8_t get_tima() { sync_timers(); return tima_; }
         [[nodiscard]] uint8_t get_tma() const { return tma_; }
 
         void reset();
         void reset_cycle_counter() { cycles_ = 0; }
-        void reset_div_reg() { this->div_reg_ = 0; }
+        void reset_div_reg() { sync_timers(); this->div_reg_ = 0; }
 
-        void set_tac(uint8_t tac_new) { tac_ = tac_new; }
-        void set_tima(uint8_t tima_new) { this->tima_ = tima_new; }
+        void set_tac(uint8_t tac_new) { sync_timers(); tac_ = tac_new; schedule_timer_overflow(); }
+        void set_tima(uint8_t tima_new) { sync_timers(); this->tima_ = tima_new; schedule_timer_overflow(); }
         void set_tma(uint8_t tma_new) { this->tma_ = tma_new; }
-        void update_timer_counter() { timer_counter_ = gb::cpu::timer_ctr_reset_values[tac_.to_ulong() & 0b11]; }
+        void update_timer_counter() {
+            sync_timers();
+            timer_counter_ = gb::cpu::timer_ctr_reset_values[tac_.to_ulong() & 0b11];
+            schedule_timer_overflow();
+        }
 
-        void set_double_speed(bool val) { double_speed_ = val; }
+        void set_double_speed(bool val) { sync_timers(); double_speed_ = val; }
         [[nodiscard]] bool double_speed() const { return double_speed_; }
 
-        void update_timers(unsigned int cycles);
+        // Timers are only brought up to date when they are read or written and when TIMA overflows
+        void sync_timers();
+        void timer_event();
+
+        // Compiles hot runs of register-only instructions to native code where the recompiler is available, does
+        // nothing elsewhere
+        void set_jit_enabled(bool enabled);
+#ifdef OHBOI_JIT
+        [[nodiscard]] bool jit_enabled() const { return jit_ != nullptr; }
+#else
+        [[nodiscard]] bool jit_enabled() const { return false; }
+#endif
+
+        // Called by Memory when a RAM page holding cached code is written, returns whether the page still holds code
+        bool invalidate_code(int ram_page, uint16_t addr);
+
+        // Decoded ROM code survives a load, blocks cached from RAM are dropped since RAM now holds something else
+        void save_state(State_writer &out) const;
+        void load_state(State_reader &in);
 
     private:
         Gameboy& gb_;
@@ -69,6 +112,7 @@ namespace gb::cpu {
         uint8_t tma_;
         std::bitset<8> tac_;
         int timer_counter_;
+        uint64_t timers_synced_;
 
         uint8_t div_reg_;
         uint16_t div_counter_;
@@ -83,17 +127,52 @@ namespace gb::cpu {
 
         unsigned int cycles_;
 
-        const std::vector<void (Cpu::*)(uint8_t)> alu_functions_;
-        const std::vector<uint8_t (Cpu::*)(uint8_t)> rotate_instructions_;
+        Block_cache block_cache_;
+        const Block_cache::Block *current_block_;
+        size_t block_pos_;
+        unsigned int block_mapping_;
+
+        // Last time the polling loop execution is in went back to its start
+        struct Idle_loop {
+            unsigned int block_id;
+            uint64_t time;
+            uint64_t stable_until;
+            uint64_t period;
+            unsigned int cycles;
+            unsigned int cycle_period;
+            std::array<uint16_t, 5> regs;
+        } idle_loop_;
+        Idle_loop_stats idle_loop_stats_;
+        Jit_stats jit_stats_;
+#ifdef OHBOI_JIT
+        std::unique_ptr<Jit> jit_;
+
+        bool run_native(unsigned int max_cycles, uint64_t until);
+#endif
 
         inline uint8_t read_memory(unsigned int addr);
         inline void write_memory(unsigned int addr, uint8_t val);
 
         void decode_n_xecute(uint8_t opcode, Instr_argument arg);
+        inline uint8_t alu_operand(uint8_t opcode);
+        void update_timers(uint64_t cycles);
+        void schedule_timer_overflow();
+        uint64_t timer_stable_until(uint16_t addr);
+        void skip_idle_loop();
+
+        inline void check_idle_loop();
+        inline void interpret();
+        inline void begin_step();
+        inline void end_step();
         unsigned int fetch();
+        [[nodiscard]] inline bool at_block_boundary() const;
+        const Block_cache::Block *enter_block();
+        const Block_cache::Instruction *next_cached_instruction();
+        const Block_cache::Block *decode_block(uint16_t pc);
         void service_interrupts();
         inline uint16_t stack_pop();
         inline void stack_push(uint16_t val);
+        [[nodiscard]] bool joypad_held() const;
         void update_buttons();
 
         inline void write_memory_short(uint16_t addr, uint16_t val);
@@ -130,7 +209,13 @@ namespace gb::cpu {
         void sub(uint8_t val);
         void xor_l(uint8_t val);
 
-        // CB-prefixed instructions
+        // CB-prefixed instructions. Each of the 256 opcodes gets its own handler, instantiated from cb_op and collected
+        // in a table at compile time, so register operands and the operation are resolved without any runtime decoding.
+        using Cb_handler = void (Cpu::*)();
+        template <uint8_t opcode> void cb_op();
+        template <size_t... opcodes>
+        static constexpr std::array<Cb_handler, sizeof...(opcodes)> make_cb_table(std::index_sequence<opcodes...>);
+
         void cb(uint8_t opcode);
         void bit(int n, uint8_t val);
         [[nodiscard]] uint8_t rl(uint8_t val);
@@ -140,7 +225,6 @@ namespace gb::cpu {
         [[nodiscard]] uint8_t sla(uint8_t val);
         [[nodiscard]] uint8_t sra(uint8_t val);
         [[nodiscard]] uint8_t srl(uint8_t val);
-        void srl_a();
         [[nodiscard]] uint8_t swap(uint8_t val);
     };
 }
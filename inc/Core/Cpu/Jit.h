@@ -0,0 +1,123 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_JIT_H
+#define OHBOI_JIT_H
+
+// The recompiler emits x86-64 code for the System V ABI and maps it through a memfd, which is Linux only. Everything
+// else (or a build defining OHBOI_NO_JIT) only has the interpreter.
+#if defined(__x86_64__) && defined(__linux__) && !defined(OHBOI_NO_JIT)
+#define OHBOI_JIT
+#endif
+
+#ifdef OHBOI_JIT
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Block_cache.h"
+
+namespace gb::cpu {
+    class Registers;
+
+    /* Translates runs of instructions that only work on registers and flags (loads between registers and of immediates,
+     * 8-bit ALU, inc/dec, 16-bit inc/dec and add hl, rotates and the CB operations on registers) into native x86-64
+     * code. Nothing in a run touches memory, so all a run does to the rest of the machine is move time forward: the
+     * native code only updates the registers in place, and the Cpu clocks the machine for the whole run in one go,
+     * when it can tell that no event would have come due in the middle of it.
+     *
+     * Runs are cut out of the block cache's blocks, at least min_run instructions long, and are counted every time the
+     * Cpu reaches their first instruction. Hot ones are queued for compilation, which happens on a worker thread: the
+     * emulation thread picks the finished ones up when it looks a run up, and never waits for the compiler. Code is
+     * written through a writable mapping of a memfd and executed through a second, executable one. Nothing is ever
+     * freed before the Jit goes away: runs are keyed by the id of their block, which is never reused, and once the
+     * arena is full nothing more gets compiled.
+     *
+     * Every function compiled is listed in /tmp/perf-<pid>.map so that perf can attribute samples to it. */
+    class Jit {
+    public:
+        using Run_fn = void (*)(Registers *regs, uint16_t *sp);
+
+        // What a compiled run does besides updating the registers
+        struct Run {
+            Run_fn fn;
+            uint16_t instructions;
+            uint16_t bytes;
+            // Times the interpreter clocks the machine by 4 cycles going through the run
+            uint16_t clocks;
+            uint16_t cycles;
+        };
+
+        static constexpr unsigned int min_run = 2;
+
+        // nullptr when no executable memory can be had
+        static std::unique_ptr<Jit> create();
+        ~Jit();
+        Jit(const Jit &) = delete;
+        Jit &operator=(const Jit &) = delete;
+
+        // Fills in the run lengths of a freshly decoded block
+        static void mark_runs(Block_cache::Block &block);
+
+        // The run starting at the given instruction of the block, or nullptr while it is cold or being compiled
+        const Run *lookup(const Block_cache::Block &block, size_t pos);
+
+        [[nodiscard]] size_t compiled_runs() const { return compiled_; }
+    private:
+        static constexpr unsigned int hot_threshold = 32;
+        static constexpr size_t arena_size = 16 << 20;
+
+        struct Entry {
+            unsigned int hits;
+            bool queued;
+            Run run;
+        };
+        struct Job {
+            uint64_t key;
+            std::vector<Block_cache::Instruction> instructions;
+        };
+        struct Result {
+            uint64_t key;
+            Run run;
+        };
+
+        int fd_;
+        uint8_t *writable_;
+        uint8_t *executable_;
+        size_t arena_used_;
+
+        std::unordered_map<uint64_t, Entry> entries_;
+        size_t compiled_;
+
+        std::mutex mutex_;
+        std::condition_variable jobs_available_;
+        std::deque<Job> jobs_;
+        std::vector<Result> results_;
+        std::atomic<bool> results_ready_;
+        bool stop_;
+        std::ofstream perf_map_;
+        std::thread worker_;
+
+        Jit(int fd, uint8_t *writable, uint8_t *executable);
+
+        static uint64_t key(const Block_cache::Block &block, size_t pos) { return (uint64_t{block.id} << 8) | pos; }
+        static bool translates(const Block_cache::Instruction &instruction);
+
+        void work();
+        Run compile(const Job &job);
+        void install_results();
+    };
+}
+
+#endif
+
+#endif //OHBOI_JIT_H
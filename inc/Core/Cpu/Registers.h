@@ -5,7 +5,14 @@
 #ifndef OHBOI_REGISTERS_H
 #define OHBOI_REGISTERS_H
 
-#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+// With lazy flags the ALU operations only record their operands and result, Z/N/H/C are worked out when F is read or
+// a flag is tested. Building with OHBOI_NO_LAZY_FLAGS computes them right away, same results either way.
+#ifndef OHBOI_NO_LAZY_FLAGS
+#define OHBOI_LAZY_FLAGS
+#endif
 
 const unsigned int REG_B = 0;
 const unsigned int REG_C = 1;
@@ -39,20 +46,51 @@ namespace gb::cpu {
         void load_short(unsigned int r, uint16_t val);
         [[nodiscard]] uint16_t read_short(unsigned int r) const;
 
-        [[nodiscard]] bool zero() const;
-        [[nodiscard]] bool carry() const;
-        [[nodiscard]] bool sub() const;
-        [[nodiscard]] bool half_carry() const;
+        [[nodiscard]] inline bool zero() const;
+        [[nodiscard]] inline bool carry() const;
+        [[nodiscard]] inline bool sub() const;
+        [[nodiscard]] inline bool half_carry() const;
 
         void set_zero(bool val);
         void set_carry(bool val);
         void set_sub(bool val);
         void set_half_carry(bool val);
 
+        // Flags of the 8-bit ALU operations. carry is the incoming carry of adc/sbc, 0 otherwise
+        inline void set_add_flags(uint8_t a, uint8_t val, uint8_t carry);
+        inline void set_sub_flags(uint8_t a, uint8_t val, uint8_t carry);
+        // inc and dec leave the carry alone
+        inline void set_inc_flags(uint8_t result);
+        inline void set_dec_flags(uint8_t result);
+        // and sets the half carry, or and xor clear it
+        inline void set_logic_flags(uint8_t result, bool half_carry);
+
         void load(unsigned int dest, unsigned int src);
+
+        /* Native code from the recompiler works on the registers in place, F included as a plain byte: the flags of a
+         * pending ALU operation have to be worked out into it before it runs */
+        void flush_flags();
+        [[nodiscard]] static size_t offset_of(unsigned int r);
     private:
         uint8_t a;
-        std::bitset<8> flags;
+        uint8_t flags;
+#ifdef OHBOI_LAZY_FLAGS
+        // Last ALU operation whose flags haven't been worked out yet, the flags it doesn't touch are still in flags
+        enum class Flag_op : uint8_t {
+            none, add, sub, inc, dec, and_op, or_op
+        };
+        Flag_op flag_op;
+        uint8_t flag_a;
+        uint8_t flag_val;
+        uint8_t flag_carry;
+        uint8_t flag_result;
+
+        void defer_flags(Flag_op op, uint8_t a, uint8_t val, uint8_t carry, uint8_t result);
+        [[nodiscard]] uint8_t evaluate_flags() const;
+#endif
+        [[nodiscard]] bool flag(unsigned int bit) const { return (flags >> bit) & 1; }
+        void assign_flag(unsigned int bit, bool val) { flags = val ? flags | (1 << bit) : flags & ~(1 << bit); }
+
         union {
             struct {
                 uint8_t c{};
@@ -75,6 +113,116 @@ namespace gb::cpu {
             uint16_t hl;
         };
     };
+
+    inline bool Registers::zero() const {
+#ifdef OHBOI_LAZY_FLAGS
+        if ( flag_op != Flag_op::none )
+            return flag_result == 0;
+#endif
+        return flag(ZERO_FLAG);
+    }
+
+    inline bool Registers::sub() const {
+#ifdef OHBOI_LAZY_FLAGS
+        if ( flag_op != Flag_op::none )
+            return flag_op == Flag_op::sub || flag_op == Flag_op::dec;
+#endif
+        return flag(SUB_FLAG);
+    }
+
+    inline bool Registers::half_carry() const {
+#ifdef OHBOI_LAZY_FLAGS
+        switch ( flag_op ) {
+            case Flag_op::add:    return (flag_a & 0xF) + (flag_val & 0xF) + flag_carry > 0xF;
+            case Flag_op::sub:    return (flag_a & 0xF) < (flag_val & 0xF) + flag_carry;
+            case Flag_op::inc:    return (flag_result & 0xF) == 0;
+            case Flag_op::dec:    return (flag_result & 0xF) == 0xF;
+            case Flag_op::and_op: return true;
+            case Flag_op::or_op:  return false;
+            case Flag_op::none:   break;
+        }
+#endif
+        return flag(HALF_CARRY_FLAG);
+    }
+
+    inline bool Registers::carry() const {
+#ifdef OHBOI_LAZY_FLAGS
+        switch ( flag_op ) {
+            case Flag_op::add:    return flag_a + flag_val + flag_carry > 0xFF;
+            case Flag_op::sub:    return flag_a < flag_val + flag_carry;
+            case Flag_op::and_op:
+            case Flag_op::or_op:  return false;
+            default:              break;
+        }
+#endif
+        return flag(CARRY_FLAG);
+    }
+
+#ifdef OHBOI_LAZY_FLAGS
+    inline void Registers::defer_flags(Flag_op op, uint8_t a_, uint8_t val, uint8_t carry, uint8_t result) {
+        // inc and dec keep the carry of whatever came before them
+        if ( op == Flag_op::inc || op == Flag_op::dec )
+            assign_flag(CARRY_FLAG, this->carry());
+        flag_op = op;
+        flag_a = a_;
+        flag_val = val;
+        flag_carry = carry;
+        flag_result = result;
+    }
+#endif
+
+    inline void Registers::set_add_flags(uint8_t a_, uint8_t val, uint8_t carry) {
+#ifdef OHBOI_LAZY_FLAGS
+        defer_flags(Flag_op::add, a_, val, carry, a_ + val + carry);
+#else
+        set_zero(static_cast<uint8_t>(a_ + val + carry) == 0);
+        set_sub(false);
+        set_half_carry((a_ & 0xF) + (val & 0xF) + carry > 0xF);
+        set_carry(a_ + val + carry > 0xFF);
+#endif
+    }
+
+    inline void Registers::set_sub_flags(uint8_t a_, uint8_t val, uint8_t carry) {
+#ifdef OHBOI_LAZY_FLAGS
+        defer_flags(Flag_op::sub, a_, val, carry, a_ - val - carry);
+#else
+        set_zero(static_cast<uint8_t>(a_ - val - carry) == 0);
+        set_sub(true);
+        set_half_carry((a_ & 0xF) < (val & 0xF) + carry);
+        set_carry(a_ < val + carry);
+#endif
+    }
+
+    inline void Registers::set_inc_flags(uint8_t result) {
+#ifdef OHBOI_LAZY_FLAGS
+        defer_flags(Flag_op::inc, 0, 0, 0, result);
+#else
+        set_zero(result == 0);
+        set_sub(false);
+        set_half_carry((result & 0xF) == 0);
+#endif
+    }
+
+    inline void Registers::set_dec_flags(uint8_t result) {
+#ifdef OHBOI_LAZY_FLAGS
+        defer_flags(Flag_op::dec, 0, 0, 0, result);
+#else
+        set_zero(result == 0);
+        set_sub(true);
+        set_half_carry((result & 0xF) == 0xF);
+#endif
+    }
+
+    inline void Registers::set_logic_flags(uint8_t result, bool half_carry) {
+#ifdef OHBOI_LAZY_FLAGS
+        defer_flags(half_carry ? Flag_op::and_op : Flag_op::or_op, 0, 0, 0, result);
+#else
+        set_zero(result == 0);
+        set_sub(false);
+        set_half_carry(half_carry);
+        set_carry(false);
+#endif
+    }
 }
 
 
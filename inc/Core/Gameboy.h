@@ -6,8 +6,10 @@
 #define OHBOI_GAMEBOY_H
 
 #include <filesystem>
+#include <functional>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include "Core/Cpu/Cpu.h"
 #include "Core/Audio/apu.h"
@@ -15,18 +17,38 @@
 #include "Core/Graphics/Hdma_controller.h"
 #include "Core/Joypad.h"
 #include "Core/Memory/Memory.h"
+#include "Core/Savestate.h"
+#include "Core/Scheduler.h"
 
 namespace gb {
     class Gameboy {
     public:
+        // Called with the screen as soon as a frame is complete
+        using Video_sink = std::function<void(const uint32_t *screen)>;
+        // Called at the end of a run with the samples produced, frames of interleaved left/right values
+        using Audio_sink = std::function<void(const float *samples, size_t frames)>;
+        // Called with every byte written to the serial port, test ROMs report their results this way
+        using Serial_sink = std::function<void(uint8_t byte)>;
+
+        // Cycles from the start of one VBlank to the next, on the master timeline
+        static constexpr unsigned int frame_cycles = 70224;
+
         explicit Gameboy(std::filesystem::path &rom_path);
-        ~Gameboy() { std::cout << "Gameboy destroyed" << std::endl; }
+        ~Gameboy() = default;
         void disable_bg() const { gpu_->toggle_bg(); }
         void disable_sprites() const { gpu_->toggle_sprites(); }
         void disable_window() const { gpu_->toggle_window(); }
 
         [[nodiscard]] unsigned int get_cpu_cycles() const { return cpu_->get_cycles(); }
-        [[nodiscard]] uint32_t * get_screen() const { return gpu_->get_screen(); }
+        // Consumer side of the Ppu's frames, see graphics::Ppu, safe to call from another thread than the one running
+        bool acquire_frame() const { return gpu_->acquire_frame(); }
+        [[nodiscard]] const uint32_t *frame() const { return gpu_->frame(); }
+        [[nodiscard]] uint64_t frame_sequence() const { return gpu_->frame_sequence(); }
+        // The frame finished last, from the thread running the Gameboy
+        [[nodiscard]] const uint32_t *last_frame() const { return gpu_->last_frame(); }
+        [[nodiscard]] uint64_t frames_published() const { return gpu_->frames_published(); }
+        void publish_frame() const { gpu_->publish_frame(); }
+        void set_publish_frames(bool val) const { gpu_->set_publish_frames(val); }
 
         [[nodiscard]] bool is_paused() const { return paused_; }
         void toggle_pause() { paused_ = not paused_; }
@@ -35,9 +57,29 @@ namespace gb {
         void release_key(Joypad::key_e k) const { joypad_->release(k); }
         void set_key(Joypad::key_e k, Joypad::key_state state) { joypad_->set_key_state(k, state); }
         void reset_cpu_cycle_counter() const { cpu_->reset_cycle_counter(); }
-        void set_speed(unsigned int multiplier) { speed_multiplier_ = multiplier; }
+        // In tenths of normal speed, frontends keeping time by frames run speed() / 10 of them per frame shown
+        void set_speed(unsigned int multiplier);
+        [[nodiscard]] unsigned int speed() const { return speed_multiplier_; }
+        [[nodiscard]] const cpu::Cpu::Idle_loop_stats &idle_loop_stats() const { return cpu_->idle_loop_stats(); }
+        // Compiled code only runs within run_cycles and run_frame, step always goes one instruction at a time
+        void toggle_jit() { cpu_->set_jit_enabled(!cpu_->jit_enabled()); }
+        [[nodiscard]] bool jit_enabled() const { return cpu_->jit_enabled(); }
+        [[nodiscard]] const cpu::Cpu::Jit_stats &jit_stats() const { return cpu_->jit_stats(); }
         void step();
 
+        /* Runs until the given number of Cpu cycles has gone by or VBlank begins, whichever comes first, then hands the
+         * finished frame and the samples produced to the sinks. Returns the cycles actually run, which can go past the
+         * limit by the length of the last instruction. Nothing runs while paused. */
+        unsigned int run_cycles(unsigned int cycles);
+        // Runs up to the next VBlank, or for as long as a frame lasts if the LCD is off
+        unsigned int run_frame();
+        // Whether the last run stopped because VBlank began
+        [[nodiscard]] bool frame_ready() const { return gpu_->frame_ready(); }
+
+        void set_video_sink(Video_sink sink) { video_sink_ = std::move(sink); }
+        void set_audio_sink(Audio_sink sink) { audio_sink_ = std::move(sink); }
+        void set_serial_sink(Serial_sink sink) { serial_sink_ = std::move(sink); }
+
         void toggle_ch1() { apu_.toggle_ch1(); }
         void toggle_ch2() { apu_.toggle_ch2(); }
         void toggle_noise() { apu_.toggle_noise(); }
@@ -45,15 +87,29 @@ namespace gb {
 
         [[nodiscard]] bool new_audio_available() { return apu_.new_audio_available(); }
         void set_audio_reproduced() { apu_.set_reproduced(); }
-        [[nodiscard]] const apu::audio_output& get_audio_output() { return apu_.get_audio_output(); }
+        [[nodiscard]] const std::vector<float>& get_audio_output() { return apu_.get_audio_output(); }
+        // Samples produced per second of emulated time
+        void set_audio_rate(double rate) { apu_.set_sample_rate(rate); }
 
         [[nodiscard]] bool is_in_vblank() const { return gpu_->get_state() == graphics::Ppu::Ppu_state::vblank; }
+
+        /* Snapshot of the whole machine, see Savestate.h for the format. Saving into the same vector every time reuses
+         * its memory. A state only loads into a Gameboy running the same ROM on the same hardware model: anything else,
+         * or a blob of another version, is refused and leaves the machine untouched. Frontend settings (speed, pause,
+         * channel and layer toggles) and the keys being held aren't part of it. */
+        void save_state(std::vector<uint8_t> &out) const;
+        [[nodiscard]] std::vector<uint8_t> save_state() const;
+        bool load_state(const uint8_t *data, size_t size);
+        bool load_state(const std::vector<uint8_t> &state) { return load_state(state.data(), state.size()); }
     private:
         friend class cpu::Cpu;
         friend class memory::Memory;
         friend class graphics::Ppu;
         friend class graphics::Hdma_controller;
 
+        // Declared first, every component schedules its events from its constructor
+        Scheduler scheduler_;
+
         /* Need to make these unique_ptr because they share a Cpu::Interrupts object that I can only create in the
          * constructor's body because it's useless to make it a class member, so I can't initialize them in the constructor
          * initializer list.
@@ -75,8 +131,19 @@ namespace gb {
         bool is_cgb_;
         bool paused_;
         unsigned int speed_multiplier_;
+        // Tenths of a cycle clock hasn't moved the timeline by yet, see clock
+        unsigned int clock_remainder_;
+
+        Video_sink video_sink_;
+        Audio_sink audio_sink_;
+        Serial_sink serial_sink_;
 
         void clock(unsigned int cycles);
+        // Runs for the given Cpu cycles or up to the given time, whichever comes first, stopping early at VBlank
+        unsigned int run(unsigned int cycles, uint64_t until);
+        unsigned int skip_idle(unsigned int cycles, unsigned int max_cycles);
+        bool clock_without_events(unsigned int clocks, uint64_t until);
+        void run_event(const Scheduler::Entry &entry);
     };
 }
 
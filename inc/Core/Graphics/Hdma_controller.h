@@ -7,6 +7,7 @@
 
 #include <cstdint>
 #include "util.h"
+#include "Core/Savestate.h"
 
 namespace gb {
     class Gameboy;
@@ -25,6 +26,9 @@ namespace gb::graphics {
         void set_length(uint8_t len);
         [[nodiscard]] uint8_t get_length() const { return hdma_len_mode_.val; }
 
+        void save_state(State_writer &out) const;
+        void load_state(State_reader &in);
+
         union {
             uint16_t val;
             gb::util::Bit_field<uint16_t, 0, 8> lsb;
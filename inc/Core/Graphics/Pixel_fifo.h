@@ -0,0 +1,49 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_PIXEL_FIFO_H
+#define OHBOI_PIXEL_FIFO_H
+
+#include <array>
+#include <cstdint>
+
+namespace gb::graphics {
+    /* Queue of pixels for the FIFOs of the Ppu, which never hold more than two tiles' worth: the background one is only
+     * refilled while it has 8 pixels or fewer, the sprite one never goes past 8. A ring of 16 entries in place, indexed
+     * through a mask, so that pushing and popping a pixel come down to a store or a load and an increment, with
+     * nothing ever allocated. Pixels past the capacity are dropped. */
+    template<typename T>
+    class Pixel_fifo {
+    public:
+        static constexpr uint8_t capacity = 16;
+
+        void push_back(const T &pixel) {
+            if ( size_ == capacity )
+                return;
+            pixels_[(head_ + size_) & mask] = pixel;
+            size_++;
+        }
+        void pop_front() {
+            head_ = (head_ + 1) & mask;
+            size_--;
+        }
+        void clear() { head_ = size_ = 0; }
+
+        [[nodiscard]] const T &front() const { return pixels_[head_]; }
+        // i-th pixel from the front
+        T &operator[](uint8_t i) { return pixels_[(head_ + i) & mask]; }
+        const T &operator[](uint8_t i) const { return pixels_[(head_ + i) & mask]; }
+
+        [[nodiscard]] uint8_t size() const { return size_; }
+        [[nodiscard]] bool empty() const { return size_ == 0; }
+    private:
+        static constexpr uint8_t mask = capacity - 1;
+
+        std::array<T, capacity> pixels_{};
+        uint8_t head_ = 0;
+        uint8_t size_ = 0;
+    };
+}
+
+#endif //OHBOI_PIXEL_FIFO_H
@@ -8,13 +8,10 @@
 // lcd Status bits
 #define COINCIDENCE_FLAG        2
 
+#include <array>
 #include <bitset>
 #include <memory>
 
-#include <iostream>
-#include <queue>
-#include <map>
-#include <functional>
 #include <stdint-gcc.h>
 
 #include "Core/Memory/Address_space.h"
@@ -23,6 +20,9 @@
 #include "Tile.h"
 #include "util.h"
 #include "Hdma_controller.h"
+#include "Pixel_fifo.h"
+#include "Core/Savestate.h"
+#include "Core/Triple_buffer.h"
 
 using std::bitset;
 
@@ -43,6 +43,7 @@ namespace gb::graphics {
         uint8_t priority_;
         uint8_t palette_;
 
+        Tile_pixel() = default;
         Tile_pixel(uint8_t c) {
             color_ = c;
             priority_ = 0;
@@ -83,12 +84,36 @@ namespace gb::graphics {
         public:
             explicit Pixel_fetcher(Ppu &ppu);
 
-            void step();
+            // Advances the fetcher by one dot, the per-dot loop of pixel transfer calls this once for every dot it runs
+            template<bool Cgb> void step() {
+                switch ( fetcher_state_ ) {
+                    case Pixel_fetcher_state::get_tile:
+                        get_tile<Cgb>();
+                        break;
+                    case Pixel_fetcher_state::get_tile_data_low:
+                        if ( step_dot_divider() )
+                            fetcher_state_ = Pixel_fetcher_state::get_tile_data_high;
+                        break;
+                    case Pixel_fetcher_state::get_tile_data_high:
+                        get_tile_data_hi();
+                        break;
+                    case Pixel_fetcher_state::sleep:
+                        if ( step_dot_divider() )
+                            fetcher_state_ = Pixel_fetcher_state::push;
+                        break;
+                    case Pixel_fetcher_state::push:
+                        push<Cgb>();
+                        break;
+                }
+            }
             void reset(uint8_t x, uint8_t y, bool r_window);
             void start_sprite_fetch(Sprite &s, uint8_t y);
             [[nodiscard]] bool is_rendering_sprites() const { return rendering_sprites_; }
             const Sprite& get_spr() { return spr_; }
 
+            void save_state(State_writer &out) const;
+            void load_state(State_reader &in);
+
         private:
             Ppu &ppu_;
             Sprite spr_;
@@ -110,19 +135,15 @@ namespace gb::graphics {
 
             int dot_clock_divider_;
 
-            std::map<Pixel_fetcher_state, std::function<void(void)>> state_callbacks_;
-
             bool step_dot_divider() {
                 return (dot_clock_divider_++ & 1) == 1;
             }
 
-            void initialize_state_callbacks();
-
-            void get_tile();
-            void get_tile_data_lo();
+            // The steps that depend on the hardware model come in a DMG and a CGB version, the Ppu picks the model once
+            // per run of dots rather than once per dot
+            template<bool Cgb> void get_tile();
             void get_tile_data_hi();
-            void sleep();
-            void push();
+            template<bool Cgb> void push();
         };
     public:
         Ppu(Gameboy &pGB, std::shared_ptr<cpu::Interrupts> interrupts);
@@ -156,14 +177,21 @@ namespace gb::graphics {
             hblank, vblank, oam_search, pixel_transfer
         } state_;
 
-        void step(unsigned int cycles);
         void reset();
 
+        // Catches up with the master timeline (or time), running every dot since the last sync
+        void sync(uint64_t time);
+        void sync();
+        // After catching up, the timestamp up to which (excluded) reads of LY or STAT are sure to return what they do now
+        uint64_t stable_until(uint16_t addr);
+
         uint8_t read(uint16_t addr);
         void send(uint16_t addr, uint8_t val);
 
         uint8_t read_vram(uint16_t addr);
         void write_vram(uint16_t addr, uint8_t val);
+        // Host memory of the currently selected VRAM bank, mapped directly into the CPU page table for reads
+        uint8_t *vram_bank_data() { return vram_.data() + 0x2000 * (vram_bank_ & 1); }
 
         uint8_t read_oam(uint16_t addr) { return oam_[addr]; }
         void write_oam(uint16_t addr, uint8_t val) { oam_[addr] = val; }
@@ -172,24 +200,55 @@ namespace gb::graphics {
         void toggle_sprites() { enable_sprites_ = !enable_sprites_; }
         void toggle_window() { enable_window_ = !enable_window_; }
 
-        uint32_t *get_screen() { return screen_; }
+        using Frame = std::array<uint32_t, 160 * 144>;
+
+        /* Frames are drawn into the back slot of a triple buffer and published as VBlank begins, which is when they're
+         * complete. Whoever consumes them, from any one thread, acquires the latest and reads it without copying it;
+         * the Ppu itself only reads back the one it finished last. */
+        bool acquire_frame() { return frames_.acquire(); }
+        [[nodiscard]] const uint32_t *frame() const { return frames_.front().data(); }
+        [[nodiscard]] uint64_t frame_sequence() const { return frames_.front_sequence(); }
+        // Stays whole until the next frame is published, or starts being drawn if this one wasn't
+        [[nodiscard]] const uint32_t *last_frame() const { return finished_; }
+        [[nodiscard]] uint64_t frames_published() const { return frames_.published(); }
+        // Publishes the frame finished last, to show a state just loaded
+        void publish_frame();
+        // While off, frames are drawn but not published, as for those run ahead to be thrown away
+        void set_publish_frames(bool val) { publish_frames_ = val; }
+
         [[nodiscard]] Ppu_state get_state() const { return state_; }
+        // Raised when VBlank begins, the frame is published then
+        [[nodiscard]] bool frame_ready() const { return frame_ready_; }
+        void clear_frame_ready() { frame_ready_ = false; }
+
+        /* Both the lines drawn so far of the frame in progress and the last frame finished go in: the first so that a
+         * state taken mid-frame carries on drawing the same frame, the second so that a state loaded while paused shows
+         * the frame it was taken on. */
+        void save_state(State_writer &out) const;
+        void load_state(State_reader &in);
     private:
         Gameboy& gb_;
         std::shared_ptr<cpu::Interrupts> interrupts_;
+        uint64_t synced_;
         std::vector<Sprite> sprites_;
 
         std::vector<Tile> tileset_;
         std::vector<Tile> tileset_bank1_;
 
         Pixel_fetcher pixel_fetcher_;
-        std::queue<Tile_pixel> bg_fifo_;
-        std::deque<Sprite_pixel> spr_fifo_;
+        Pixel_fifo<Tile_pixel> bg_fifo_;
+        Pixel_fifo<Sprite_pixel> spr_fifo_;
 
         memory::Address_space oam_;
         memory::Address_space vram_;
 
-        uint32_t screen_[160 * 144]{};
+        Triple_buffer<Frame> frames_;
+        // The frame being drawn, the back slot of frames_, and the last one finished
+        uint32_t *screen_;
+        const uint32_t *finished_;
+        // Where a loaded state's finished frame is kept until the next VBlank, the slots of frames_ may be in use
+        Frame loaded_frame_{};
+        bool publish_frames_ = true;
         uint32_t bg_pal_colors_[4]{}, obj0_pal_colors_[4]{}, obj1_pal_colors_[4]{};
 
         union {
@@ -218,6 +277,10 @@ namespace gb::graphics {
         uint8_t vram_bank_{};
 
         bool rendering_window_ = false;
+        // Set while the line in pixel transfer is left to be drawn whole once it's over, see can_draw_whole_line()
+        bool whole_line_ = false;
+        uint16_t whole_line_end_ = 0;
+        bool frame_ready_ = false;
         uint8_t internal_window_counter_ = 0;
         uint16_t scanline_counter_{};
         int current_pixel_ = 0;
@@ -251,7 +314,20 @@ namespace gb::graphics {
         bool enable_bg_{};
         bool enable_sprites_{};
 
-        void render_pixel();
+        void step(unsigned int cycles);
+        void schedule_next_event();
+
+        // Pixel transfer runs dot by dot, once per model so that DMG games don't pay for the CGB checks and vice versa
+        template<bool Cgb> unsigned int run_pixel_transfer(unsigned int cycles);
+        template<bool Cgb> void render_pixel();
+
+        /* Lines with no sprites and no window, nothing that can stall the fetcher, take a fixed number of dots and can
+         * be drawn all at once from the registers as they are at the end of pixel transfer, provided nothing was written
+         * in the meantime. A write to a Ppu register during such a line makes it fall back to the FIFO, which replays
+         * the dots gone by so far with the registers as they were, then goes on dot by dot. */
+        [[nodiscard]] bool can_draw_whole_line() const;
+        template<bool Cgb> void draw_whole_line();
+        void fall_back_to_fifo();
 
         void update_state(Ppu_state new_state);
 
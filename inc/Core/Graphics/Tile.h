@@ -7,11 +7,10 @@
 
 #include <cstdint>
 #include <array>
-#include <iostream>
 
 class Tile {
 public:
-    Tile();
+    Tile() = default;
     explicit Tile(const uint8_t data[16]);
 
     [[nodiscard]] uint8_t get_color(int x, int y) const { return tile_colors_[y][x]; }
@@ -8,6 +8,8 @@
 #include <cstdint>
 #include <bitset>
 
+#include "Core/Savestate.h"
+
 
 const uint8_t button_keys = 0x20u;
 const uint8_t direction_keys = 0x10u;
@@ -41,6 +43,10 @@ public:
     [[nodiscard]] bool direction_pressed() const;
 
     [[nodiscard]] bool is_pressed(key_e key) const;
+
+    // Only the selected key group is machine state, the keys themselves follow the host
+    void save_state(gb::State_writer &out) const;
+    void load_state(gb::State_reader &in);
 private:
     bool m_dir_selected;
     bool m_buttons_selected;
@@ -10,11 +10,13 @@
 
 #include <vector>
 
+#include "Core/Savestate.h"
+
 namespace gb::memory {
     class Address_space {
     public:
         explicit Address_space(unsigned int space_size) : size_ {space_size} {
-            m_.reserve(space_size);
+            m_.resize(space_size);
         }
         virtual ~Address_space() = default;
 
@@ -28,7 +30,14 @@ namespace gb::memory {
             return m_[i];
         }
 
+        uint8_t *data() { return m_.data(); }
+        [[nodiscard]] unsigned int size() const { return size_; }
+
         void clear() { std::fill(m_.begin(), m_.end(), 0); }
+
+        // The size is fixed by the hardware model and the cartridge, so only the contents go in the save state
+        void save_state(State_writer &out) const { out.write_bytes(m_.data(), m_.size()); }
+        void load_state(State_reader &in) { in.read_bytes(m_.data(), m_.size()); }
     protected:
         std::vector<uint8_t> m_;
         unsigned int size_;
@@ -22,6 +22,15 @@ namespace gb::memory {
         void set_enabled(bool e) { enabled = e; }
         [[nodiscard]] bool is_enabled() const { return enabled; }
 
+        void save_state(State_writer &out) const {
+            Address_space::save_state(out);
+            out.write(enabled);
+        }
+        void load_state(State_reader &in) {
+            Address_space::load_state(in);
+            in.read(enabled);
+        }
+
         void save_to_savfile(std::ofstream &out) {
 //            std::ofstream out(sav_path.c_str(), std::ios::out | std::ios::binary);
             out.write((char *) m_.data(), size_);
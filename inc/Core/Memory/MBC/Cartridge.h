@@ -0,0 +1,57 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_CARTRIDGE_H
+#define OHBOI_CARTRIDGE_H
+
+#include <filesystem>
+#include <memory>
+#include <utility>
+#include <variant>
+
+#include <Core/Memory/MBC/Mbc.h>
+#include <Core/Memory/MBC/Mbc1.h>
+#include <Core/Memory/MBC/Mbc3.h>
+#include <Core/Memory/MBC/Mbc5.h>
+#include <Core/Memory/MBC/None.h>
+
+namespace gb::memory::mbc {
+    /* The cartridge's memory bank controller. The set of controllers is closed, so they live in a variant: register
+     * and external RAM accesses are dispatched with std::visit, and everything that only needs the shared state
+     * (ROM reads, the mapped banks) goes straight to the Mbc base. */
+    class Cartridge {
+    public:
+        template<typename T, typename... Args>
+        explicit Cartridge(std::in_place_type_t<T> type, Args&&... args)
+                : mbc_(type, std::forward<Args>(args)...),
+                  base_(std::visit([](Mbc &mbc) { return &mbc; }, mbc_)) {}
+        Cartridge(const Cartridge &) = delete;
+        Cartridge &operator=(const Cartridge &) = delete;
+
+        [[nodiscard]] uint8_t read(uint16_t addr) const { return base_->read(addr); }
+        void write(uint16_t addr, uint8_t val) { std::visit([=](auto &mbc) { mbc.write(addr, val); }, mbc_); }
+        uint8_t read_ram(uint16_t addr) { return std::visit([=](auto &mbc) { return mbc.read_ram(addr); }, mbc_); }
+        void write_ram(uint16_t addr, uint8_t val) {
+            std::visit([=](auto &mbc) { mbc.write_ram(addr, val); }, mbc_);
+        }
+
+        [[nodiscard]] unsigned int rom_bank(uint16_t addr) const { return base_->rom_bank(addr); }
+        [[nodiscard]] const uint8_t *rom_bank_data(uint16_t addr) const { return base_->rom_bank_data(addr); }
+
+        [[nodiscard]] bool has_battery() const { return base_->has_battery(); }
+        [[nodiscard]] bool has_rtc() const { return base_->has_rtc(); }
+        [[nodiscard]] bool is_cgb() const { return base_->is_cgb(); }
+        [[nodiscard]] uint64_t rom_hash() const { return base_->rom_hash(); }
+
+        void save_state(State_writer &out) const { std::visit([&](const auto &mbc) { mbc.save_state(out); }, mbc_); }
+        void load_state(State_reader &in) { std::visit([&](auto &mbc) { mbc.load_state(in); }, mbc_); }
+    private:
+        std::variant<None, Mbc1, Mbc3, Mbc5> mbc_;
+        Mbc *base_;
+    };
+
+    std::unique_ptr<Cartridge> make_mbc(std::filesystem::path& rom_path);
+}
+
+#endif //OHBOI_CARTRIDGE_H
@@ -8,6 +8,7 @@
 
 #include <Core/Memory/Rom.h>
 #include <Core/Memory/Ext_ram.h>
+#include <Core/Savestate.h>
 #include "RTC.h"
 
 namespace gb::memory::mbc {
@@ -26,6 +27,10 @@ namespace gb::memory::mbc {
     const unsigned int rom_bank_size = 0x4000;
     const unsigned int ram_bank_size = 0x2000;
 
+    /* State shared by every memory bank controller. The controllers themselves (None, Mbc1, Mbc3, Mbc5) only handle
+     * writes to their registers and external RAM, and are dispatched through the variant held by Cartridge rather
+     * than a vtable. ROM reads don't involve them at all: they recompute the banks mapped at 0x0000 and 0x4000 when a
+     * bank register is written, and everything else reads the cached bank pointers. */
     class Mbc {
     public:
         Mbc(std::filesystem::path &rom_path, bool battery, bool rtc, bool has_ram, unsigned int rom_banks,
@@ -40,16 +45,36 @@ namespace gb::memory::mbc {
                 rtc_clock.write_saved_time(out, 48);
             }
         };
-        virtual uint8_t read(uint16_t) = 0;
-        virtual void write(uint16_t, uint8_t) = 0;
-        virtual uint8_t read_ram(uint16_t) = 0;
-        virtual void write_ram(uint16_t, uint8_t) = 0;
+        Mbc(const Mbc &) = delete;
+        Mbc &operator=(const Mbc &) = delete;
+
+        [[nodiscard]] uint8_t read(uint16_t addr) const { return rom_bank_data(addr)[addr & (rom_bank_size - 1)]; }
+        // Returns the ROM bank currently mapped at the given CPU address (0x0000-0x7FFF)
+        [[nodiscard]] unsigned int rom_bank(uint16_t addr) const { return addr < rom_bank_size ? bank0_ : bank1_; }
+        // Host pointer to the start of the ROM bank mapped at addr, used by Memory to build its page table
+        [[nodiscard]] const uint8_t *rom_bank_data(uint16_t addr) const {
+            return addr < rom_bank_size ? bank0_data_ : bank1_data_;
+        }
 
         [[nodiscard]] bool has_battery() const { return has_battery_; }
         [[nodiscard]] bool has_rtc() const { return has_rtc_; }
         [[nodiscard]] bool is_cgb() const { return cgb; }
+        // Identifies the game a save state was taken on
+        [[nodiscard]] uint64_t rom_hash() const { return rom_.hash(); }
+
+        // State shared by all controllers, each one adds its registers and remaps its banks after loading
+        void save_state(State_writer &out) const;
+        void load_state(State_reader &in);
 
     protected:
+        // Called by the controllers whenever the selected banks may have changed
+        void map_banks(unsigned int bank0, unsigned int bank1) {
+            bank0_ = bank0 % rom_banks_n;
+            bank1_ = bank1 % rom_banks_n;
+            bank0_data_ = rom_.data() + bank0_ * rom_bank_size;
+            bank1_data_ = rom_.data() + bank1_ * rom_bank_size;
+        }
+
         Rom rom_;
         Ext_ram ram_;
         uint8_t latch;
@@ -67,9 +92,12 @@ namespace gb::memory::mbc {
         mbc_banking_mode banking_mode_;
     private:
         bool cgb;
-    };
 
-    std::unique_ptr<Mbc> make_mbc(std::filesystem::path& rom_path);
+        unsigned int bank0_;
+        unsigned int bank1_;
+        const uint8_t *bank0_data_;
+        const uint8_t *bank1_data_;
+    };
 }
 
 
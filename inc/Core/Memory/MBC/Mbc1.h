@@ -12,13 +12,17 @@ namespace gb::memory::mbc {
     public:
         Mbc1(std::filesystem::path& rom_path, bool battery, bool has_ram, unsigned int rom_banks, unsigned int ram_banks);
 
-        uint8_t read(uint16_t) override;
-        void write(uint16_t, uint8_t val) override;
-        uint8_t read_ram(uint16_t) override;
-        void write_ram(uint16_t, uint8_t) override;
+        void write(uint16_t, uint8_t val);
+        uint8_t read_ram(uint16_t);
+        void write_ram(uint16_t, uint8_t);
+
+        void save_state(State_writer &out) const;
+        void load_state(State_reader &in);
     private:
         int mRomBankLo;
         int mRomBankHi;
+
+        void update_banks();
     };
 }
 
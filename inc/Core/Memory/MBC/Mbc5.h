@@ -13,17 +13,19 @@ namespace gb::memory::mbc {
     public:
         Mbc5(std::filesystem::path& rom_path, bool battery, bool has_ram, unsigned int rom_banks, unsigned int ram_banks);
 
-        [[nodiscard]] uint8_t read(uint16_t) override;
-        void write(uint16_t, uint8_t) override;
+        void write(uint16_t, uint8_t);
 
-        [[nodiscard]] uint8_t read_ram(uint16_t addr) override {
+        [[nodiscard]] uint8_t read_ram(uint16_t addr) {
             return (has_ram_ && ram_.is_enabled()) ? ram_.read(mbc5_ram_bank * ram_bank_size + addr) : 0xFF;
         }
-        void write_ram(uint16_t addr, uint8_t val) override {
+        void write_ram(uint16_t addr, uint8_t val) {
             if ( has_ram_ && ram_.is_enabled() ) {
                 ram_.write(mbc5_ram_bank * ram_bank_size + addr, val);
             }
         }
+
+        void save_state(State_writer &out) const;
+        void load_state(State_reader &in);
     private:
         uint8_t mbc5_rom_lo;
         uint8_t mbc5_rom_hi;
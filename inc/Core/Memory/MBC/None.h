@@ -16,11 +16,10 @@ namespace gb::memory::mbc {
             ram_.set_enabled(false);
         }
 
-        uint8_t read(uint16_t) override;
-        uint8_t read_ram(uint16_t) override;
-    private:
-        [[maybe_unused]] void write(uint16_t, uint8_t) override {};
-        [[maybe_unused]] void write_ram(uint16_t, uint8_t) override {};
+        // No registers and no RAM, writes go nowhere
+        void write(uint16_t, uint8_t) {}
+        uint8_t read_ram(uint16_t);
+        void write_ram(uint16_t, uint8_t) {}
     };
 }
 
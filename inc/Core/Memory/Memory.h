@@ -5,9 +5,10 @@
 #ifndef OHBOI_MEMORY_H
 #define OHBOI_MEMORY_H
 
-#include <iostream>
+#include <array>
+#include <vector>
 
-#include <Core/Memory/MBC/Mbc.h>
+#include <Core/Memory/MBC/Cartridge.h>
 #include <Core/Memory/Wram.h>
 #include "Core/Cpu/Interrupts.h"
 #include "Core/Memory/Address_space.h"
@@ -20,14 +21,42 @@ namespace gb {
 namespace gb::memory {
     class Memory {
     public:
-        Memory(gb::Gameboy &gb, std::shared_ptr<gb::cpu::Interrupts> interrupts, std::unique_ptr<mbc::Mbc> controller);
+        Memory(gb::Gameboy &gb, std::shared_ptr<gb::cpu::Interrupts> interrupts, std::unique_ptr<mbc::Cartridge> controller);
         ~Memory() = default;
 
-        uint8_t read(uint16_t addr);
-        void write(uint16_t addr, uint8_t val);
-
-        void step_dma(unsigned int cycles);
+        uint8_t read(uint16_t addr) {
+            const uint8_t *page = read_pages_[addr >> 8];
+            return page ? page[addr & 0xFF] : read_slow(addr);
+        }
+        void write(uint16_t addr, uint8_t val) {
+            uint8_t *page = write_pages_[addr >> 8];
+            if ( page )
+                page[addr & 0xFF] = val;
+            else
+                write_slow(addr, val);
+        }
+
+        // Refresh the page table entries of a region after its bank selection changed
+        void map_rom();
+        void map_vram();
+        void map_wram();
+        // Bumped every time the page table changes, so that cached decodings of the old mapping can be dropped
+        [[nodiscard]] unsigned int mapping_generation() const { return mapping_generation_; }
+
+        // Bank holding the code at addr, or -1 if code running from there can't be cached
+        [[nodiscard]] int code_bank(uint16_t addr) const;
+        // Start trapping writes to the RAM page holding addr, returns the page or -1 if addr is in ROM
+        int watch_code(uint16_t addr);
+
+        // Scheduler events: a DMA transfer steps once per clock slice, a serial transfer completes in one go
+        void step_dma();
+        void serial_event();
         [[nodiscard]] bool is_dma_completed() const { return dma_controller_.is_completed(); }
+
+        [[nodiscard]] uint64_t rom_hash() const { return controller_->rom_hash(); }
+        // Loaded after the Ppu, the page table is rebuilt from the banks the state selects
+        void save_state(State_writer &out) const;
+        void load_state(State_reader &in);
     private:
         Gameboy& gb_;
 
@@ -41,6 +70,9 @@ namespace gb::memory {
             [[nodiscard]] uint8_t get_index() const { return mem_index_; }
             [[nodiscard]] bool is_running() const { return !(dma_completed_ || dma_wait_); }
             [[nodiscard]] bool is_completed() const { return dma_completed_; }
+
+            void save_state(State_writer &out) const;
+            void load_state(State_reader &in);
         private:
             Memory& mem_;
             uint8_t mem_index_;
@@ -51,7 +83,7 @@ namespace gb::memory {
             bool dma_wait_;
         } dma_controller_;
 
-        std::unique_ptr<mbc::Mbc> controller_;
+        std::unique_ptr<mbc::Cartridge> controller_;
         std::shared_ptr<cpu::Interrupts> interrupts_;
 
         Address_space hram_;
@@ -61,6 +93,23 @@ namespace gb::memory {
 
         bool booting_;
 
+        /* One entry per 256-byte page of the address space. Pages backed by plain host memory (ROM banks, VRAM for
+         * reads, WRAM and its echo) point straight to it, so the common access is a single indexed load. Null entries
+         * fall back to read_slow/write_slow, which handle everything with side effects (MBC registers, external RAM,
+         * OAM, IO and HRAM). */
+        std::array<const uint8_t *, 256> read_pages_{};
+        std::array<uint8_t *, 256> write_pages_{};
+        unsigned int mapping_generation_;
+
+        /* Physical WRAM pages (and HRAM, as the last entry) that hold code cached by the Cpu. Their write_pages_ entries
+         * stay null so that writes get to write_slow and invalidate the cache. */
+        std::vector<bool> code_pages_;
+        [[nodiscard]] int code_page(uint16_t addr) const;
+        void code_written(uint16_t addr);
+
+        uint8_t read_slow(uint16_t addr);
+        void write_slow(uint16_t addr, uint8_t val);
+
         uint8_t read_io_port(uint16_t port_addr);
         void write_io_port(uint16_t port_addr, uint8_t val);
 
@@ -5,24 +5,49 @@
 #ifndef OHBOI_ROM_H
 #define OHBOI_ROM_H
 
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
-#include <iterator>
-
-#include "Core/Memory/Address_space.h"
+#include <memory>
+#include <vector>
 
 namespace gb::memory {
-    class Rom : public gb::memory::Address_space {
+    /* The contents of a cartridge ROM file. Images are mapped read-only straight from the file where the platform
+     * allows it, and are shared process-wide: every Rom opened on a file with the same contents, whatever its path,
+     * points at the same image, which is released when the last of them goes away. The hash of the contents
+     * identifies the ROM in save states too. */
+    class Rom_image {
+    public:
+        Rom_image(const std::filesystem::path &rom_path, unsigned int size);
+        ~Rom_image();
+        Rom_image(const Rom_image &) = delete;
+        Rom_image &operator=(const Rom_image &) = delete;
+
+        [[nodiscard]] const uint8_t *data() const { return data_; }
+        [[nodiscard]] unsigned int size() const { return size_; }
+        [[nodiscard]] uint64_t hash() const { return hash_; }
+    private:
+        const uint8_t *data_;
+        unsigned int size_;
+        uint64_t hash_;
+
+        void *mapping_;
+        size_t mapping_size_;
+        // Used instead of a mapping when the file is shorter than its header claims, or can't be mapped
+        std::vector<uint8_t> copy_;
+    };
+
+    class Rom {
     public:
-        Rom(std::filesystem::path& rom_path, unsigned int size) : Address_space(size) {
-            std::ifstream file(rom_path.c_str(), std::ios::in | std::ios::binary);
-            m_.reserve(size);
-            file.read((char *) m_.data(), size);
-            //m_.insert(m_.begin(), std::istream_iterator<uint8_t>(file), std::istream_iterator<uint8_t>());
-        };
+        Rom(std::filesystem::path& rom_path, unsigned int size);
+
+        [[nodiscard]] uint8_t read(unsigned int address) const { return data_[address]; }
+        [[nodiscard]] const uint8_t *data() const { return data_; }
+        [[nodiscard]] unsigned int size() const { return image_->size(); }
+        [[nodiscard]] uint64_t hash() const { return image_->hash(); }
+        // Cannot write to ROM. The Mbc takes care of eventual writes to ROM address space.
     private:
-        // Cannot write to ROM. The Mbc takes care of eventual writes to ROM address space, so make Rom::write private.
-        using Address_space::write;
+        std::shared_ptr<const Rom_image> image_;
+        const uint8_t *data_;
     };
 }
 
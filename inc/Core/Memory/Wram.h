@@ -27,9 +27,18 @@ namespace gb::memory {
         void switch_bank(int b) {
             this->bank = b;
         }
-        int get_bank() {
+        int get_bank() const {
             return bank;
         }
+
+        void save_state(State_writer &out) const {
+            Address_space::save_state(out);
+            out.write(bank);
+        }
+        void load_state(State_reader &in) {
+            Address_space::load_state(in);
+            in.read(bank);
+        }
     private:
         int bank;
     };
@@ -0,0 +1,70 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_REWIND_H
+#define OHBOI_REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace gb {
+    class Gameboy;
+
+    /* History of save states, one per captured frame, that can be stepped back through. Every keyframe_interval
+     * captures a whole state is kept as a keyframe, the ones in between only as their XOR against the last keyframe:
+     * consecutive frames differ in a few hundred bytes, so the deltas are almost all zeroes and shrink to next to
+     * nothing with a simple run-length encoding. The oldest keyframe goes, along with its deltas, whenever the history
+     * outgrows the memory budget, so the budget is what decides how many seconds can be rewound. */
+    class Rewind_buffer {
+    public:
+        struct Capture_stats {
+            uint64_t captures;      // States captured since the buffer was created
+            uint64_t total_ns;      // Time spent capturing them, saving the state included
+            uint64_t last_ns;       // Cost of the last capture
+            size_t last_size;       // Compressed size of the last capture
+        };
+
+        explicit Rewind_buffer(size_t budget_bytes, unsigned int keyframe_interval = 60);
+
+        // Records the current state of gb, call once per frame
+        void capture(const Gameboy &gb);
+        // Loads the latest captured state into gb and forgets it, returns false when there's nothing left
+        bool rewind(Gameboy &gb);
+        void clear();
+
+        void set_budget(size_t budget_bytes);
+        [[nodiscard]] size_t budget() const { return budget_; }
+        [[nodiscard]] size_t memory_used() const { return memory_used_; }
+        [[nodiscard]] size_t frames() const { return entries_.size(); }
+        [[nodiscard]] double seconds() const;
+        [[nodiscard]] const Capture_stats &capture_stats() const { return stats_; }
+    private:
+        struct Entry {
+            bool keyframe;
+            std::vector<uint8_t> data;
+        };
+
+        size_t budget_;
+        unsigned int keyframe_interval_;
+        std::deque<Entry> entries_;
+        size_t memory_used_;
+        // Deltas captured since the last keyframe
+        unsigned int since_keyframe_;
+
+        // Uncompressed keyframe the newest entries are relative to, plus scratch space reused from frame to frame
+        std::vector<uint8_t> keyframe_;
+        std::vector<uint8_t> state_;
+        std::vector<uint8_t> delta_;
+        std::vector<uint8_t> packed_;
+
+        Capture_stats stats_;
+
+        void evict();
+        void push(bool keyframe);
+    };
+}
+
+#endif //OHBOI_REWIND_H
@@ -0,0 +1,54 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_RUN_AHEAD_H
+#define OHBOI_RUN_AHEAD_H
+
+#include <cstdint>
+#include <vector>
+
+namespace gb {
+    class Gameboy;
+
+    /* Hides the frame of input lag games have on top of the frontend's own: after every real frame, the state is saved,
+     * the machine runs some frames further with the input as it is now, and the last of them is what gets displayed
+     * before going back to the saved state. Only that last frame is published by the Ppu, the real one and those before
+     * it are drawn and thrown away. Audio always comes from the real frame, the speculative frames would play the same
+     * sounds again every frame; it's handed out by Run_ahead itself, the Gameboy must have no sinks set.
+     *
+     * Each ahead frame costs a whole emulated frame plus a save and a load, so the mode is only worth turning on when the
+     * core runs several times faster than real time. The stats keep track of that cost against the real frame's. */
+    class Run_ahead {
+    public:
+        struct Stats {
+            uint64_t frames;        // Real frames run
+            uint64_t real_ns;       // Time spent running them
+            uint64_t ahead_ns;      // Time spent running ahead of them, saving and loading included
+        };
+
+        explicit Run_ahead(unsigned int frames = 0);
+
+        // Runs one real frame, up to the next VBlank, then the speculative ones. Does nothing while gb is paused.
+        void run_frame(Gameboy &gb);
+
+        void set_frames(unsigned int frames) { frames_ = frames; }
+        [[nodiscard]] unsigned int frames() const { return frames_; }
+
+        // Samples of the real frame, interleaved left/right
+        [[nodiscard]] const std::vector<float> &audio() const { return audio_; }
+
+        [[nodiscard]] const Stats &stats() const { return stats_; }
+        // Time spent running ahead for each unit of time spent on the real frames
+        [[nodiscard]] double overhead() const {
+            return stats_.real_ns != 0 ? static_cast<double>(stats_.ahead_ns) / static_cast<double>(stats_.real_ns) : 0;
+        }
+    private:
+        unsigned int frames_;
+        std::vector<float> audio_;
+        std::vector<uint8_t> state_;
+        Stats stats_;
+    };
+}
+
+#endif //OHBOI_RUN_AHEAD_H
@@ -0,0 +1,106 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_SAVESTATE_H
+#define OHBOI_SAVESTATE_H
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace gb {
+    /* Save states are a flat little-endian blob: a fixed header followed by every component's state in a fixed order,
+     * with no tags or padding in between, so that saving and loading come down to a series of memcpys. Components write
+     * plain values and trivially copyable structs whole, variable length containers are prefixed with their size.
+     *
+     * Bump state_version whenever the layout of anything written changes, blobs of other versions are refused. */
+    const uint32_t state_magic = 0x5342484F;    // "OHBS"
+    const uint32_t state_version = 4;
+
+    class State_writer {
+    public:
+        // Appends to out, which keeps its capacity from one save to the next
+        explicit State_writer(std::vector<uint8_t> &out) : out_(out) {}
+
+        void write_bytes(const void *data, size_t size) {
+            size_t pos = out_.size();
+            out_.resize(pos + size);
+            std::memcpy(out_.data() + pos, data, size);
+        }
+
+        template<typename T>
+        void write(const T &val) {
+            static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable values can be written whole");
+            write_bytes(&val, sizeof(T));
+        }
+
+        template<typename T>
+        void write_vector(const std::vector<T> &v) {
+            write(static_cast<uint32_t>(v.size()));
+            static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable values can be written whole");
+            write_bytes(v.data(), v.size() * sizeof(T));
+        }
+
+        [[nodiscard]] size_t size() const { return out_.size(); }
+        // Fills in a value reserved earlier, such as a length known only at the end
+        template<typename T>
+        void patch(size_t pos, const T &val) { std::memcpy(out_.data() + pos, &val, sizeof(T)); }
+    private:
+        std::vector<uint8_t> &out_;
+    };
+
+    // Reads past the end of the blob yield zeroes and mark the reader as failed instead of touching anything else
+    class State_reader {
+    public:
+        State_reader(const uint8_t *data, size_t size) : data_(data), size_(size), pos_(0), failed_(false) {}
+
+        void read_bytes(void *dest, size_t size) {
+            if ( size > size_ - pos_ ) {
+                failed_ = true;
+                std::memset(dest, 0, size);
+                return;
+            }
+            std::memcpy(dest, data_ + pos_, size);
+            pos_ += size;
+        }
+
+        template<typename T>
+        void read(T &val) {
+            static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable values can be read whole");
+            read_bytes(&val, sizeof(T));
+        }
+
+        template<typename T>
+        [[nodiscard]] T read() {
+            std::array<uint8_t, sizeof(T)> bytes;
+            read_bytes(bytes.data(), sizeof(T));
+            return std::bit_cast<T>(bytes);
+        }
+
+        template<typename T>
+        void read_vector(std::vector<T> &v) {
+            auto n = read<uint32_t>();
+            if ( static_cast<size_t>(n) * sizeof(T) > size_ - pos_ ) {
+                failed_ = true;
+                return;
+            }
+            v.resize(n);
+            read_bytes(v.data(), n * sizeof(T));
+        }
+
+        [[nodiscard]] bool failed() const { return failed_; }
+        [[nodiscard]] bool at_end() const { return pos_ == size_; }
+    private:
+        const uint8_t *data_;
+        size_t size_;
+        size_t pos_;
+        bool failed_;
+    };
+}
+
+#endif //OHBOI_SAVESTATE_H
@@ -0,0 +1,73 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_SCHEDULER_H
+#define OHBOI_SCHEDULER_H
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace gb {
+    /* Master timeline of the machine. Gameboy::clock only moves the timestamp forward, components stay where they were
+     * last synced and are caught up when one of their events falls due or when the Cpu touches their registers.
+     *
+     * Every kind of event has at most one pending occurrence, kept in a small binary min-heap indexed by event kind, so
+     * that rescheduling an event just moves its entry around instead of leaving stale ones behind. Events due at the
+     * same time run in the order of the enum, which is the order Gameboy::clock used to step the components in. */
+    class Scheduler {
+    public:
+        enum Event : uint8_t {
+            dma, timer, ppu, serial, apu_frame_sequencer, n_events
+        };
+
+        struct Entry {
+            uint64_t time;
+            Event event;
+        };
+
+        Scheduler();
+
+        [[nodiscard]] uint64_t now() const { return now_; }
+        // Timestamp before the last call to advance, where the slice of time currently being dispatched began
+        [[nodiscard]] uint64_t slice_start() const { return slice_start_; }
+        void advance(unsigned int cycles) {
+            slice_start_ = now_;
+            now_ += cycles;
+        }
+
+        [[nodiscard]] bool pending() const { return size_ != 0 && heap_[0].time <= now_; }
+        // Time of the earliest event, the maximum timestamp when nothing is scheduled
+        [[nodiscard]] uint64_t next_time() const {
+            return size_ != 0 ? heap_[0].time : std::numeric_limits<uint64_t>::max();
+        }
+        // Removes the earliest event, only meaningful when pending() is true
+        Entry pop();
+
+        // (Re)schedules an event at an absolute timestamp, replacing its previous occurrence
+        void schedule(Event event, uint64_t time);
+        void cancel(Event event);
+        [[nodiscard]] bool is_scheduled(Event event) const { return index_[event] >= 0; }
+        [[nodiscard]] uint64_t time_of(Event event) const {
+            return is_scheduled(event) ? heap_[index_[event]].time : std::numeric_limits<uint64_t>::max();
+        }
+    private:
+        std::array<Entry, n_events> heap_;
+        std::array<int, n_events> index_;
+        int size_;
+
+        uint64_t now_;
+        uint64_t slice_start_;
+
+        static bool before(const Entry &a, const Entry &b) {
+            return a.time < b.time || (a.time == b.time && a.event < b.event);
+        }
+        void place(int i, const Entry &e);
+        void sift_up(int i);
+        void sift_down(int i);
+        void remove_at(int i);
+    };
+}
+
+#endif //OHBOI_SCHEDULER_H
@@ -0,0 +1,63 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_TRIPLE_BUFFER_H
+#define OHBOI_TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace gb {
+    /* Hands whole values, frames in practice, from exactly one producer thread to one consumer thread without locking
+     * and without either side ever waiting for the other. The producer fills the back slot and publishes it, the
+     * consumer picks up the latest published slot as its front one; a third slot sits in the middle between the two,
+     * swapped with an atomic exchange by either side. Values published faster than they're picked up replace each other,
+     * the consumer only ever sees the latest, and always a whole one. Each value is numbered as it's published, so the
+     * consumer can tell how many it missed. */
+    template<typename T>
+    class Triple_buffer {
+    public:
+        Triple_buffer() : slots_{}, sequences_{}, back_(0), latest_(1), published_(0), middle_(1), front_(2) {}
+
+        // Producer side: the slot to fill, it's the producer's until publish()
+        T &back() { return slots_[back_]; }
+        // Producer side: makes the back slot the latest value and gets another one to fill
+        void publish() {
+            sequences_[back_] = ++published_;
+            latest_ = back_;
+            back_ = middle_.exchange(back_ | fresh, std::memory_order_acq_rel) & index_mask;
+        }
+        /* Producer side: the value published last. The consumer only ever reads it, and the producer can't get its slot
+         * back before publishing again, so it stays intact and readable until then. */
+        [[nodiscard]] const T &latest() const { return slots_[latest_]; }
+        // Producer side: values published so far
+        [[nodiscard]] uint64_t published() const { return published_; }
+
+        // Consumer side: moves to the latest value if one was published since the last call, returns whether it did
+        bool acquire() {
+            if ( !(middle_.load(std::memory_order_relaxed) & fresh) )
+                return false;
+            front_ = middle_.exchange(front_, std::memory_order_acq_rel) & index_mask;
+            return true;
+        }
+        // Consumer side: the value acquired last, it's the consumer's until the next acquire()
+        [[nodiscard]] const T &front() const { return slots_[front_]; }
+        // Consumer side: the number the front value was published with, counting from 1, 0 before the first one
+        [[nodiscard]] uint64_t front_sequence() const { return sequences_[front_]; }
+    private:
+        // The middle slot's index keeps a flag along with it, set while it holds a value the consumer hasn't seen
+        static constexpr uint8_t index_mask = 0x3;
+        static constexpr uint8_t fresh = 0x4;
+
+        T slots_[3];
+        uint64_t sequences_[3];
+        uint8_t back_;
+        uint8_t latest_;
+        uint64_t published_;
+        alignas(64) std::atomic<uint8_t> middle_;
+        alignas(64) uint8_t front_;
+    };
+}
+
+#endif //OHBOI_TRIPLE_BUFFER_H
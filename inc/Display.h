@@ -13,7 +13,7 @@ public:
     Display();
     ~Display();
 
-    void update_display(Uint32 *framebuffer);
+    void update_display(const Uint32 *framebuffer);
     void clear();
     void set_title(const char *new_title) { if ( window != nullptr) SDL_SetWindowTitle(window, new_title); }
     std::string get_title() { return window != nullptr ? SDL_GetWindowTitle(window) : ""; };
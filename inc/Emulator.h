@@ -0,0 +1,85 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#ifndef OHBOI_EMULATOR_H
+#define OHBOI_EMULATOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Core/Gameboy.h>
+#include <Core/Joypad.h>
+#include <Core/Rewind.h>
+#include <Core/Run_ahead.h>
+
+class Audio;
+
+/* Runs the Gameboy on a thread of its own, paced by the emulated frame rate, so that presenting a frame never holds
+ * up emulation and the other way around. Finished frames come straight out of the Ppu's triple buffer, the keys held
+ * go in through an atomic word the thread applies before every frame. Anything else that touches the Gameboy is posted as a
+ * command the thread runs between frames, the Gameboy itself is never touched from outside it. */
+class Emulator {
+public:
+    using Command = std::function<void(gb::Gameboy &)>;
+
+    explicit Emulator(Audio &audio);
+    ~Emulator();
+
+    // Stops the running game, if any, and starts gb on a new thread
+    void start(std::unique_ptr<gb::Gameboy> gb);
+    void stop();
+    [[nodiscard]] bool running() const { return thread.joinable(); }
+
+    void press(Joypad::key_e key) { keys.fetch_or(static_cast<uint8_t>(1u << key), std::memory_order_relaxed); }
+    void release(Joypad::key_e key) { keys.fetch_and(static_cast<uint8_t>(~(1u << key)), std::memory_order_relaxed); }
+    // While set, frames step back through the rewind history instead of running
+    void set_rewinding(bool val) { rewinding.store(val, std::memory_order_relaxed); }
+
+    // Runs command on the emulation thread before its next frame
+    void post(Command command);
+    // Run-ahead and rewind live on the emulation thread, only touch them from a command
+    gb::Run_ahead &get_run_ahead() { return run_ahead; }
+    gb::Rewind_buffer &get_rewind_buffer() { return rewind_buffer; }
+
+    // Moves to the latest frame if a new one was finished since the last call, returns whether there was one
+    bool new_frame();
+    // The frame moved to last, stays the same until the next new_frame()
+    [[nodiscard]] const uint32_t *frame() const { return gb->frame(); }
+    // Frames moved to, and those finished in between that were never moved to, since the game was started
+    [[nodiscard]] uint64_t frames_shown() const { return shown; }
+    [[nodiscard]] uint64_t frames_dropped() const { return dropped; }
+private:
+    Audio &audio;
+    std::unique_ptr<gb::Gameboy> gb;
+    std::thread thread;
+    std::atomic<bool> quit;
+
+    // One bit per Joypad::key_e, set while held
+    std::atomic<uint8_t> keys;
+    std::atomic<bool> rewinding;
+
+    std::mutex commands_mutex;
+    std::vector<Command> commands;
+    // Swapped with commands under the lock, so that they run without holding it
+    std::vector<Command> pending;
+
+    gb::Rewind_buffer rewind_buffer;
+    gb::Run_ahead run_ahead;
+
+    // Only touched by the thread presenting frames
+    uint64_t shown;
+    uint64_t dropped;
+    uint64_t last_sequence;
+
+    void run();
+    void run_commands();
+    void apply_keys(uint8_t &applied);
+};
+
+#endif //OHBOI_EMULATOR_H
@@ -6,25 +6,24 @@
 #define OHBOI_LOGGER_H
 
 #include <string>
-#include <iostream>
 
-namespace {
-    bool mEnableInfo = false;
-    bool mEnableWarning = false;
-}
+/* The core never writes to stdout or stderr itself: messages go to whatever sink the application installs, and are
+ * dropped when there is none. Info and error messages are also dropped unless turned on with the toggles. */
 namespace Logger {
+    enum class Level { info, warning, error };
+
+    using Sink = void (*)(Level level, const std::string& section, const std::string& message);
 
-    static inline void info(const std::string& section, const std::string& message) { if ( mEnableInfo ) std::cout << "[+][" << section << "] - " << message << std::endl; }
-    static inline void error(const std::string& section, const std::string& message) { if ( mEnableWarning ) std::cout << "[-][" << section << "] - " << message << std::endl; }
-    static inline void warning(const std::string& section, const std::string& message) { std::cout << "[!][" << section << "] - " << message << std::endl; }
+    void set_sink(Sink sink);
+    // Sink printing "[+][section] - message" lines to stdout, what the SDL frontend uses
+    void stdout_sink(Level level, const std::string& section, const std::string& message);
 
-    static void toggle_info() {
-        mEnableInfo = !mEnableInfo;
-    }
+    void info(const std::string& section, const std::string& message);
+    void error(const std::string& section, const std::string& message);
+    void warning(const std::string& section, const std::string& message);
 
-    static void toggle_warning() {
-        mEnableWarning = !mEnableWarning;
-    }
+    void toggle_info();
+    void toggle_warning();
 }
 
 #endif //OHBOI_LOGGER_H
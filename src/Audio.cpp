@@ -5,7 +5,13 @@
 #include <SDL2/SDL_audio.h>
 #include <Audio.h>
 
-Audio::Audio() : buffer(SAMPLE_SIZE) {
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <thread>
+
+// Room for four callbacks' worth of samples, the rate control keeps it at about two, less than 50ms
+Audio::Audio() : ring(SAMPLE_SIZE * 2 * 4), underrun_count(0) {
     SDL_AudioSpec audioSpec, have;
     SDL_memset(&audioSpec, 0, sizeof(audioSpec));
 
@@ -13,65 +19,54 @@ Audio::Audio() : buffer(SAMPLE_SIZE) {
     audioSpec.format = AUDIO_F32SYS;
     audioSpec.channels = 2;
     audioSpec.samples = SAMPLE_SIZE;
-    audioSpec.callback = nullptr;
-    audioSpec.userdata = nullptr;
+    audioSpec.callback = &Audio::callback;
+    audioSpec.userdata = this;
 
     dev = SDL_OpenAudioDevice(nullptr, 0, &audioSpec, &have,SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    device_rate = dev != 0 ? have.freq : audioSpec.freq;
     SDL_PauseAudioDevice(dev, 0);
-
-    buffer_index = 0;
-    std::fill(buffer.begin(), buffer.end(), 0);
 }
 
 Audio::~Audio() {
     SDL_CloseAudioDevice(dev);
 }
 
-void Audio::update(const apu::audio_output& output) {
-    float buffer0 = 0.0;
-    float buffer1 = 0.0;
-    int left_volume = (output.left_volume << 7) / 7;
-    int right_volume = (output.right_volume << 7) / 7;
+void Audio::push(const float *samples, size_t frames) {
+    // No device, nothing would ever drain the ring
+    if ( dev == 0 )
+        return;
 
-    if ( output.ch1_output >= 0 ) {
-        buffer1 = (float) output.ch1_output / 100;
-        SDL_MixAudioFormat((Uint8 *) ( &buffer0 ), (Uint8 *) ( &buffer1 ), AUDIO_F32SYS, sizeof(float), left_volume);
-    }
-    if ( output.ch2_output >= 0 ) {
-        buffer1 = (float) output.ch2_output / 100;
-        SDL_MixAudioFormat((Uint8 *) ( &buffer0 ), (Uint8 *) ( &buffer1 ), AUDIO_F32SYS, sizeof(float), left_volume);
+    /* Empty means the device has been starved (at start up, while paused, after a stall): go back to half full with
+     * silence right away, the rate control would take seconds to get there */
+    if ( ring.size() == 0 ) {
+        const float silence[256] = {};
+        for ( size_t n = ring.capacity() / 2; n > 0; )
+            n -= ring.write(silence, std::min(n, std::size(silence)));
     }
-    if ( output.wave_output >= 0 ) {
-        buffer1 = (float) output.wave_output / 100;
-        SDL_MixAudioFormat((Uint8 *) ( &buffer0 ), (Uint8 *) ( &buffer1 ), AUDIO_F32SYS, sizeof(float), left_volume);
-    }
-    if ( output.noise_output >= 0 ) {
-        buffer1 = (float) output.noise_output / 100;
-        SDL_MixAudioFormat((Uint8 *) ( &buffer0 ), (Uint8 *) ( &buffer1 ), AUDIO_F32SYS, sizeof(float), left_volume);
-    }
-    buffer[buffer_index++] = buffer0;
-    buffer0 = 0;
 
-    if ( output.ch1_output_right >= 0 ) {
-        buffer1 = (float) output.ch1_output_right / 100;
-        SDL_MixAudioFormat((Uint8 *) ( &buffer0 ), (Uint8 *) ( &buffer1 ), AUDIO_F32SYS, sizeof(float), right_volume);
-    }
-    if ( output.ch2_output_right >= 0 ) {
-        buffer1 = (float) output.ch2_output_right / 100;
-        SDL_MixAudioFormat((Uint8 *) ( &buffer0 ), (Uint8 *) ( &buffer1 ), AUDIO_F32SYS, sizeof(float), right_volume);
+    /* Full, the device drains a callback's worth every ~23ms. A device that hasn't done so after a few callbacks is
+     * stalled: what's left is dropped rather than blocking the emulation, which would then never see a stop request */
+    auto deadline = std::chrono::steady_clock::now()
+            + std::chrono::duration<double>(max_full_callbacks * SAMPLE_SIZE / device_rate);
+    size_t count = frames * 2;
+    while ( true ) {
+        size_t written = ring.write(samples, count);
+        samples += written;
+        count -= written;
+        if ( count == 0 || std::chrono::steady_clock::now() >= deadline )
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
-    if ( output.wave_output_right >= 0 ) {
-        buffer1 = (float) output.wave_output_right / 100;
-        SDL_MixAudioFormat((Uint8 *) ( &buffer0 ), (Uint8 *) ( &buffer1 ), AUDIO_F32SYS, sizeof(float), right_volume);
-    }
-    if ( output.noise_output_right >= 0 ) {
-        buffer1 = (float) output.noise_output_right / 100;
-        SDL_MixAudioFormat((Uint8 *) ( &buffer0 ), (Uint8 *) ( &buffer1 ), AUDIO_F32SYS, sizeof(float), right_volume);
-    }
-    buffer[buffer_index++] = buffer0;
-    if ( buffer_index >= SAMPLE_SIZE ) {
-        buffer_index = 0;
-        while (SDL_GetQueuedAudioSize(dev) > SAMPLE_SIZE * sizeof(float));
-        SDL_QueueAudio(dev, (void *) buffer.data(), SAMPLE_SIZE * sizeof(float));
+}
+
+// Runs on SDL's audio thread
+void Audio::callback(void *userdata, Uint8 *stream, int len) {
+    auto *audio = static_cast<Audio *>(userdata);
+    auto *out = reinterpret_cast<float *>(stream);
+    size_t count = static_cast<size_t>(len) / sizeof(float);
+    size_t read = audio->ring.read(out, count);
+    if ( read < count ) {
+        std::fill(out + read, out + count, 0.0f);
+        audio->underrun_count.fetch_add(1, std::memory_order_relaxed);
     }
-}
\ No newline at end of file
+}
@@ -7,9 +7,19 @@
 #include <Core/Audio/audio_ch_2.h>
 #include <Core/Audio/noise_ch.h>
 #include <Core/Audio/wave_ch.h>
-#include <iostream>
+#include <Core/Cpu/Cpu.h>
+#include <algorithm>
 
 const unsigned int SAMPLE_SIZE = 4096;
+const int FRAME_SEQUENCER_PERIOD = 8192;
+const double DEFAULT_SAMPLE_RATE = 44100.0;
+// About a second and a half of audio, samples nobody collects past this point are dropped
+const size_t MAX_BUFFERED_SAMPLES = 65536;
+
+// Channel outputs go from 0 to 15, a volume of 7 leaves them at a hundredth of that
+static float master_gain(unsigned int volume) {
+    return static_cast<float>((volume << 7) / 7) / 12800.0f;
+}
 
 static uint8_t readOrValues[23] = {  0x80,0x3f,0x00,0xff,0xbf,
                                      0xff,0x3f,0x00,0xff,0xbf,
@@ -18,8 +28,9 @@ static uint8_t readOrValues[23] = {  0x80,0x3f,0x00,0xff,0xbf,
                                      0x00,0x00,0x70 };
 
 void apu::reset() {
-    frame_sequence_counter = 8192;
-    downsample_count = 95;
+    frame_sequence_counter = FRAME_SEQUENCER_PERIOD;
+    downsample_count = static_cast<int>(downsample_period >> 32);
+    downsample_fraction = 0;
     frame_sequencer = 0;
 
     ch1_enabled = true;
@@ -27,9 +38,7 @@ void apu::reset() {
     wave_enabled = true;
     noise_enabled = true;
 
-    mAudioOutput = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-    new_audio = false;
+    audio_samples.clear();
     ch1.write(0x10u, 0x80u);
     ch1.write(0x11u, 0xBFu);
     ch1.write(0x12u, 0xF3u);
@@ -52,13 +61,23 @@ void apu::reset() {
 
     wave.clear_wave_pattern();
 //    sound_control.values = 0x81;
+    scheduler_.cancel(gb::Scheduler::apu_frame_sequencer);
+    schedule_events();
 }
 
-apu::apu() : 
+apu::apu(gb::Scheduler &scheduler) :
+        scheduler_(scheduler),
+        synced_(scheduler.now()),
+        sample_rate_(DEFAULT_SAMPLE_RATE),
+        speed_multiplier_(10),
+        vin_control{},
+        output_select{},
+        sound_control{},
         ch1(audio_ch_1()),
         ch2(audio_ch_2()),
         wave(wave_ch()),
         noise(noise_ch()) {
+    update_downsample_period();
     reset();
 }
 
@@ -78,19 +97,39 @@ void apu::toggle_noise() {
     noise_enabled = !noise_enabled; 
 }
 
-const apu::audio_output& apu::get_audio_output() const {
-    return mAudioOutput;
+const std::vector<float>& apu::get_audio_output() {
+    sync();
+    return audio_samples;
 }
 
-bool apu::new_audio_available() const { 
-    return new_audio; 
+bool apu::new_audio_available() {
+    sync();
+    return !audio_samples.empty();
 }
 
 void apu::set_reproduced() { 
-    new_audio = false; 
+    audio_samples.clear();
+}
+
+void apu::set_speed(unsigned int multiplier) {
+    sync();
+    speed_multiplier_ = multiplier;
+    update_downsample_period();
+}
+
+void apu::set_sample_rate(double rate) {
+    sync();
+    sample_rate_ = rate;
+    update_downsample_period();
+}
+
+void apu::update_downsample_period() {
+    double cycles = gb::cpu::clock_speed / sample_rate_ * speed_multiplier_ / 10;
+    downsample_period = static_cast<uint64_t>(std::max(cycles, 1.0) * 4294967296.0);
 }
 
 void apu::send(uint16_t addr, uint8_t val) {
+    sync();
     if ( not sound_control.sound_enable && addr != 0xFF26 ) {
         return;
     }
@@ -115,12 +154,18 @@ void apu::send(uint16_t addr, uint8_t val) {
                 if ( sound_control.sound_enable && (val & 0x80) == 0 ) {
                     for ( unsigned int i = 0xFF10; i <= 0xFF25; i++ )
                         send(i, 0);
+                    // The frame sequencer stands still while sound is off, remember how far it got
+                    if ( scheduler_.is_scheduled(gb::Scheduler::apu_frame_sequencer) ) {
+                        frame_sequence_counter = static_cast<int>(
+                                scheduler_.time_of(gb::Scheduler::apu_frame_sequencer) - synced_);
+                    }
                 }
                 else if ( not sound_control.sound_enable && (val & 0x80) ){
                     frame_sequencer = 0;
                     wave.clear_wave_pattern();
                 }
                 sound_control.val = val & 0x80;
+                schedule_events();
                 break;
             default:
                 break;
@@ -128,7 +173,8 @@ void apu::send(uint16_t addr, uint8_t val) {
     }
 }
 
-uint8_t apu::read(uint16_t addr) const {
+uint8_t apu::read(uint16_t addr) {
+    sync();
     uint8_t reg = addr & 0xFF;
     if ( reg >= 0x10 && reg <= 0x14 )
         return ch1.read(reg) | readOrValues[reg - 0x10];
@@ -160,74 +206,129 @@ uint8_t apu::read(uint16_t addr) const {
     return 0xFF;
 }
 
-void apu::step(int cycles) {
+void apu::sync(uint64_t time) {
+    if ( time <= synced_ )
+        return;
+    uint64_t cycles = time - synced_;
+    synced_ = time;
+    step(cycles);
+}
+
+void apu::frame_sequencer_event(uint64_t time) {
+    // The sequencer clocks before the channels step on the same cycle
+    sync(time - 1);
+    clock_frame_sequencer();
+    frame_sequence_counter = FRAME_SEQUENCER_PERIOD;
+    scheduler_.schedule(gb::Scheduler::apu_frame_sequencer, time + FRAME_SEQUENCER_PERIOD);
+}
+
+void apu::schedule_events() {
+    if ( not sound_control.sound_enable )
+        scheduler_.cancel(gb::Scheduler::apu_frame_sequencer);
+    else if ( not scheduler_.is_scheduled(gb::Scheduler::apu_frame_sequencer) )
+        scheduler_.schedule(gb::Scheduler::apu_frame_sequencer, synced_ + frame_sequence_counter);
+}
+
+void apu::clock_frame_sequencer() {
+    switch ( frame_sequencer ) {
+        case 0:
+            ch1.update_length();
+            ch2.update_length();
+            wave.update_length();
+            noise.update_length();
+            break;
+        case 2:
+            ch1.update_sweep();
+            ch1.update_length();
+            ch2.update_length();
+            wave.update_length();
+            noise.update_length();
+            break;
+        case 4:
+            ch1.update_length();
+            ch2.update_length();
+            wave.update_length();
+            noise.update_length();
+            break;
+        case 6:
+            ch1.update_sweep();
+            ch1.update_length();
+            ch2.update_length();
+            wave.update_length();
+            noise.update_length();
+            break;
+        case 7:
+            ch1.update_envelope();
+            ch2.update_envelope();
+            noise.update_envelope();
+            break;
+    }
+    if ( ++frame_sequencer >= 8 )
+        frame_sequencer = 0;
+}
+
+// The channels only get looked at when a sample is taken, so they can be stepped in one go up to the next one
+void apu::step(uint64_t cycles) {
     if ( not sound_control.sound_enable ) {
         return;
     }
-    while ( cycles-- != 0 ) {
-        if ( --frame_sequence_counter <= 0 ) {
-            frame_sequence_counter = 8192;
-            switch ( frame_sequencer ) {
-                case 0:
-                    ch1.update_length();
-                    ch2.update_length();
-                    wave.update_length();
-                    noise.update_length();
-                    break;
-                case 2:
-                    ch1.update_sweep();
-                    ch1.update_length();
-                    ch2.update_length();
-                    wave.update_length();
-                    noise.update_length();
-                    break;
-                case 4:
-                    ch1.update_length();
-                    ch2.update_length();
-                    wave.update_length();
-                    noise.update_length();
-                    break;
-                case 6:
-                    ch1.update_sweep();
-                    ch1.update_length();
-                    ch2.update_length();
-                    wave.update_length();
-                    noise.update_length();
-                    break;
-                case 7:
-                    ch1.update_envelope();
-                    ch2.update_envelope();
-                    noise.update_envelope();
-                    break;
-            }
-            if ( ++frame_sequencer >= 8 )
-                frame_sequencer = 0;
-        }
-        ch1.step();
-        ch2.step();
-        wave.step();
-        noise.step();
-
-        if ( --downsample_count <= 0 ) {
-            new_audio = true;
-            downsample_count = 95;
-
-            uint8_t ch2out = ch2.get_output();
-
-            mAudioOutput = {
-                    output_select.channel_1_left && ch1_enabled ? ch1.get_output() : 0,
-                    output_select.channel_2_left && ch2_enabled ? ch2out : 0,
-                    output_select.channel_3_left && wave_enabled ? wave.get_output() : 0,
-                    output_select.channel_4_left && noise_enabled ? noise.get_output() : 0,
-
-                    output_select.channel_1_right && ch1_enabled ? ch1.get_output() : 0,
-                    output_select.channel_2_right && ch2_enabled ? ch2out : 0,
-                    output_select.channel_3_right && wave_enabled ? wave.get_output() : 0,
-                    output_select.channel_4_right && noise_enabled ? noise.get_output() : 0,
-
-                    vin_control.left_volume,
-                    vin_control.right_volume
-            };
+    while ( cycles != 0 ) {
+        int chunk = static_cast<int>(std::min<uint64_t>(cycles, downsample_count));
+        cycles -= chunk;
+        ch1.step(chunk);
+        ch2.step(chunk);
+        wave.step(chunk);
+        noise.step(chunk);
+
+        if ( (downsample_count -= chunk) <= 0 ) {
+            uint64_t fraction = static_cast<uint64_t>(downsample_fraction) + (downsample_period & 0xFFFFFFFF);
+            downsample_fraction = static_cast<uint32_t>(fraction);
+            downsample_count = static_cast<int>((downsample_period >> 32) + (fraction >> 32));
+            if ( audio_samples.size() >= MAX_BUFFERED_SAMPLES * output_channels )
+                continue;
+
+            int ch1out = ch1_enabled ? ch1.get_output() : 0;
+            int ch2out = ch2_enabled ? ch2.get_output() : 0;
+            int waveout = wave_enabled ? wave.get_output() : 0;
+            int noiseout = noise_enabled ? noise.get_output() : 0;
+
+            int left = (output_select.channel_1_left ? ch1out : 0) + (output_select.channel_2_left ? ch2out : 0)
+                       + (output_select.channel_3_left ? waveout : 0) + (output_select.channel_4_left ? noiseout : 0);
+            int right = (output_select.channel_1_right ? ch1out : 0) + (output_select.channel_2_right ? ch2out : 0)
+                        + (output_select.channel_3_right ? waveout : 0) + (output_select.channel_4_right ? noiseout : 0);
+
+            audio_samples.push_back(static_cast<float>(left) * master_gain(vin_control.left_volume));
+            audio_samples.push_back(static_cast<float>(right) * master_gain(vin_control.right_volume));
         }
     }
 }
+
+void apu::save_state(gb::State_writer &out) const {
+    out.write(synced_);
+    out.write(vin_control.val);
+    out.write(output_select.val);
+    out.write(sound_control.val);
+    out.write(frame_sequence_counter);
+    out.write(downsample_count);
+    out.write(downsample_fraction);
+    out.write(frame_sequencer);
+    out.write(ch1);
+    out.write(ch2);
+    out.write(wave);
+    out.write(noise);
+}
+
+void apu::load_state(gb::State_reader &in) {
+    in.read(synced_);
+    in.read(vin_control.val);
+    in.read(output_select.val);
+    in.read(sound_control.val);
+    in.read(frame_sequence_counter);
+    in.read(downsample_count);
+    in.read(downsample_fraction);
+    in.read(frame_sequencer);
+    in.read(ch1);
+    in.read(ch2);
+    in.read(wave);
+    in.read(noise);
+}
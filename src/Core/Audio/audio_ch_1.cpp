@@ -2,6 +2,9 @@
 // Created by antonio on 30/07/20.
 //
 
+#include <algorithm>
+#include <cstring>
+
 #include <Core/Audio/audio_ch_1.h>
 
 static const uint8_t duty_table[4][8] = {
@@ -12,6 +15,7 @@ static const uint8_t duty_table[4][8] = {
 };
 
 audio_ch_1::audio_ch_1() {
+    std::memset(static_cast<void *>(this), 0, sizeof(*this));
     output_vol = 0;
     duty_pointer = 0;
     duty = 0;
@@ -93,10 +97,13 @@ void audio_ch_1::write(uint8_t reg, uint8_t val) {
     }
 }
 
-void audio_ch_1::step() {
-    if ( --frequency <= 0 ) {
-        frequency = (2048 - frequency_load ) << 2;
-        duty_pointer = (duty_pointer + 1) & 0x7;
+void audio_ch_1::step(int cycles) {
+    frequency = std::max(frequency, 1) - cycles;
+    if ( frequency <= 0 ) {
+        int period = (2048 - frequency_load ) << 2;
+        int reloads = -frequency / period + 1;
+        frequency += reloads * period;
+        duty_pointer = (duty_pointer + reloads) & 0x7;
     }
     output_vol = enable && dac_enable ? volume : 0;
     if ( not duty_table[nr11.wave_duty][duty_pointer] )
@@ -2,6 +2,9 @@
 // Created by antonio on 30/07/20.
 //
 
+#include <algorithm>
+#include <cstring>
+
 #include <Core/Audio/audio_ch_2.h>
 
 static const uint8_t duty_table[4][8] = {
@@ -12,6 +15,7 @@ static const uint8_t duty_table[4][8] = {
 };
 
 audio_ch_2::audio_ch_2() {
+    std::memset(static_cast<void *>(this), 0, sizeof(*this));
     output_vol = 0;
     sequence_oointer = 0;
     nr21.wave_duty = 0;
@@ -84,10 +88,13 @@ void audio_ch_2::write(uint8_t reg, uint8_t val) {
     }
 }
 
-void audio_ch_2::step() {
-    if ( --freq <= 0 ) {
-        freq = (2048 - freq_load) << 2;
-        sequence_oointer = (sequence_oointer + 1) & 0x7;
+void audio_ch_2::step(int cycles) {
+    freq = std::max(freq, 1) - cycles;
+    if ( freq <= 0 ) {
+        int period = (2048 - freq_load) << 2;
+        int reloads = -freq / period + 1;
+        freq += reloads * period;
+        sequence_oointer = (sequence_oointer + reloads) & 0x7;
     }
 
     output_vol = enable && dac_enable ? vol : 0;
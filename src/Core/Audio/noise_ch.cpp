@@ -2,11 +2,15 @@
 // Created by antonio on 30/07/20.
 //
 
+#include <algorithm>
+#include <cstring>
+
 #include <Core/Audio/noise_ch.h>
 
 static const int divisors[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
 
 noise_ch::noise_ch() {
+    std::memset(static_cast<void *>(this), 0, sizeof(*this));
     output_vol = 0;
     freq = 0;
     length_enable = false;
@@ -66,9 +70,14 @@ void noise_ch::write(uint8_t reg, uint8_t val) {
     }
 }
 
-void noise_ch::step() {
-    if ( --freq <= 0 ) {
-        freq = divisors[nr43.div_ratio] << nr43.clock_freq;
+void noise_ch::step(int cycles) {
+    freq = std::max(freq, 1) - cycles;
+    if ( freq > 0 )
+        return;
+
+    int period = divisors[nr43.div_ratio] << nr43.clock_freq;
+    while ( freq <= 0 ) {
+        freq += period;
         uint8_t res = (lfsr & 1) ^ ((lfsr >> 1) & 1);
         lfsr >>= 1;
         lfsr |= res << 14;
@@ -76,8 +85,8 @@ void noise_ch::step() {
             lfsr &= ~0x40;
             lfsr |= res << 6;
         }
-        output_vol = (enable && dac_enable && (lfsr & 1) == 0) ? vol : 0;
     }
+    output_vol = (enable && dac_enable && (lfsr & 1) == 0) ? vol : 0;
 }
 
 uint8_t noise_ch::get_output() const {
@@ -2,9 +2,13 @@
 // Created by antonio on 30/07/20.
 //
 
+#include <algorithm>
+#include <cstring>
+
 #include <Core/Audio/wave_ch.h>
 
 wave_ch::wave_ch() {
+    std::memset(static_cast<void *>(this), 0, sizeof(*this));
     std::fill(wave_pattern.begin(), wave_pattern.end(), 0);
 
     output_vol = 0;
@@ -77,10 +81,14 @@ void wave_ch::clear_wave_pattern() {
     std::fill(wave_pattern.begin(), wave_pattern.end(), 0);
 }
 
-void wave_ch::step() {
-    if ( --freq <= 0 ) {
-        freq = (2048 - freq_load) << 1;
-        position_counter = (position_counter + 1) & 0x1F;
+void wave_ch::step(int cycles) {
+    freq = std::max(freq, 1) - cycles;
+    if ( freq <= 0 ) {
+        int period = (2048 - freq_load) << 1;
+        int reloads = -freq / period + 1;
+        freq += reloads * period;
+        // Only the sample read by the last reload is left in the output
+        position_counter = (position_counter + reloads) & 0x1F;
         if ( enable && nr30.enable ) {
             uint8_t output = wave_pattern[position_counter >> 1];
             if ( (position_counter & 1) == 0 )
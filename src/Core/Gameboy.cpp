@@ -4,12 +4,14 @@
 
 #include "Core/Gameboy.h"
 
+#include <algorithm>
 #include <filesystem>
+#include <limits>
 #include "Core/Cpu/Interrupts.h"
 
 
 gb::Gameboy::Gameboy(std::filesystem::path &rom_path)
-: joypad_{ std::make_shared<Joypad>() } {
+: joypad_{ std::make_shared<Joypad>() }, apu_{ scheduler_ } {
     auto ints {std::make_shared<cpu::Interrupts>()};
     auto controller {memory::mbc::make_mbc(rom_path) };
 
@@ -21,6 +23,7 @@ gb::Gameboy::Gameboy(std::filesystem::path &rom_path)
 
     paused_ = false;
     speed_multiplier_ = 10;
+    clock_remainder_ = 0;
 }
 
 void gb::Gameboy::step() {
@@ -29,11 +32,148 @@ void gb::Gameboy::step() {
     cpu_->step();
 }
 
+unsigned int gb::Gameboy::run_cycles(unsigned int cycles) {
+    return run(cycles, std::numeric_limits<uint64_t>::max());
+}
+
+/* Bounded by the master timeline rather than by Cpu cycles: instructions don't all clock the rest of the machine for
+ * as long as they count, so a frame's worth of Cpu cycles can end a little before or after the next VBlank. The Cpu
+ * cycles a frame takes at the current speed, doubled, still cap the run in case time stops moving. */
+unsigned int gb::Gameboy::run_frame() {
+    unsigned int max_cycles = 2 * frame_cycles * 10 / std::max(speed_multiplier_, 1u);
+    return run(max_cycles, scheduler_.now() + frame_cycles);
+}
+
+unsigned int gb::Gameboy::run(unsigned int cycles, uint64_t until) {
+    if ( paused_ )
+        return 0;
+
+    gpu_->clear_frame_ready();
+    unsigned int start = cpu_->get_cycles();
+    while ( cpu_->get_cycles() - start < cycles && scheduler_.now() < until && !gpu_->frame_ready() )
+        cpu_->step(cycles - (cpu_->get_cycles() - start), until);
+
+    if ( gpu_->frame_ready() && video_sink_ )
+        video_sink_(gpu_->last_frame());
+    if ( audio_sink_ ) {
+        const auto &samples = apu_.get_audio_output();
+        if ( !samples.empty() )
+            audio_sink_(samples.data(), samples.size() / apu::output_channels);
+        apu_.set_reproduced();
+    }
+    return cpu_->get_cycles() - start;
+}
+
+void gb::Gameboy::save_state(std::vector<uint8_t> &out) const {
+    out.clear();
+    State_writer writer{out};
+    writer.write(state_magic);
+    writer.write(state_version);
+    size_t size_pos = writer.size();
+    writer.write(uint32_t{0});
+    writer.write(mmu_->rom_hash());
+    writer.write(is_cgb_);
+
+    writer.write(scheduler_);
+    cpu_->save_state(writer);
+    joypad_->save_state(writer);
+    gpu_->save_state(writer);
+    apu_.save_state(writer);
+    mmu_->save_state(writer);
+
+    writer.patch(size_pos, static_cast<uint32_t>(writer.size()));
+}
+
+std::vector<uint8_t> gb::Gameboy::save_state() const {
+    std::vector<uint8_t> state;
+    save_state(state);
+    return state;
+}
+
+bool gb::Gameboy::load_state(const uint8_t *data, size_t size) {
+    State_reader reader{data, size};
+    // Everything that could make the rest unreadable is checked before touching any component
+    if ( reader.read<uint32_t>() != state_magic || reader.read<uint32_t>() != state_version
+         || reader.read<uint32_t>() != size || reader.read<uint64_t>() != mmu_->rom_hash()
+         || reader.read<bool>() != is_cgb_ || reader.failed() )
+        return false;
+
+    reader.read(scheduler_);
+    cpu_->load_state(reader);
+    joypad_->load_state(reader);
+    gpu_->load_state(reader);
+    apu_.load_state(reader);
+    // Last, its page table points into the Ppu's VRAM
+    mmu_->load_state(reader);
+    return !reader.failed() && reader.at_end();
+}
+
+void gb::Gameboy::set_speed(unsigned int multiplier) {
+    speed_multiplier_ = multiplier;
+    apu_.set_speed(multiplier);
+}
+
+/* Only moves the master timestamp, components catch up when one of their events is due. Below normal speed a clock
+ * can be worth less than a cycle of the timeline, the fraction is carried over to the next one. */
 void gb::Gameboy::clock(unsigned int cycles) {
-    unsigned int adjusted_cycles = (cycles * speed_multiplier_) / 10;
-    if ( !mmu_->is_dma_completed() )
-        mmu_->step_dma(adjusted_cycles);
-    cpu_->update_timers(adjusted_cycles);
-    gpu_->step(adjusted_cycles);
-    apu_.step((cycles * 10u) / speed_multiplier_);
-}
\ No newline at end of file
+    unsigned int tenths = cycles * speed_multiplier_ + clock_remainder_;
+    clock_remainder_ = tenths % 10;
+    scheduler_.advance(tenths / 10);
+    while ( scheduler_.pending() )
+        run_event(scheduler_.pop());
+}
+
+/* Moves time forward by whole slices of the given length, as many as clock would go through without running any event:
+ * the slice that reaches the next event is left to the caller. Returns the number of cycles skipped, never more than
+ * max_cycles. */
+unsigned int gb::Gameboy::skip_idle(unsigned int cycles, unsigned int max_cycles) {
+    // In tenths of a cycle of the timeline, like clock counts them
+    uint64_t slice = cycles * speed_multiplier_;
+    if ( slice == 0 )
+        return 0;
+    // The gap is capped where it can't limit the slices any more, which keeps it from overflowing once in tenths
+    uint64_t gap = std::min<uint64_t>(scheduler_.next_time() - scheduler_.now() - 1, uint64_t{max_cycles} * speed_multiplier_);
+    uint64_t slices = std::min<uint64_t>((gap * 10 + 9 - clock_remainder_) / slice, max_cycles / cycles);
+    uint64_t tenths = slices * slice + clock_remainder_;
+    clock_remainder_ = static_cast<unsigned int>(tenths % 10);
+    scheduler_.advance(static_cast<unsigned int>(tenths / 10));
+    return static_cast<unsigned int>(slices) * cycles;
+}
+
+/* Moves time forward like that many clock(4) calls in a row would, provided that no event comes due and time stays
+ * before until all along. Returns false, leaving time alone, otherwise. The last clock is split off, so that the
+ * scheduler is left with the same slice as after clocking one at a time. */
+bool gb::Gameboy::clock_without_events(unsigned int clocks, uint64_t until) {
+    uint64_t slice = 4 * speed_multiplier_;
+    uint64_t before_last = (clocks - 1) * slice + clock_remainder_;
+    uint64_t last = before_last % 10 + slice;
+    uint64_t end = scheduler_.now() + before_last / 10 + last / 10;
+    if ( end >= std::min(until, scheduler_.next_time()) )
+        return false;
+    scheduler_.advance(static_cast<unsigned int>(before_last / 10));
+    scheduler_.advance(static_cast<unsigned int>(last / 10));
+    clock_remainder_ = static_cast<unsigned int>(last % 10);
+    return true;
+}
+
+void gb::Gameboy::run_event(const Scheduler::Entry &entry) {
+    switch (entry.event) {
+        case Scheduler::dma:
+            mmu_->step_dma();
+            break;
+        case Scheduler::timer:
+            cpu_->timer_event();
+            break;
+        case Scheduler::ppu:
+            gpu_->sync();
+            break;
+        case Scheduler::serial:
+            mmu_->serial_event();
+            break;
+        case Scheduler::apu_frame_sequencer:
+            apu_.frame_sequencer_event(entry.time);
+            break;
+        default:
+            break;
+    }
+}
@@ -70,7 +70,6 @@ uint32_t *CGBPalette::get_palette(int palette_number) {
 }
 
 void CGBPalette::update(int palette_number) {
-    Logger::info("CGBPalette", "Updating palette_");
     if ( palette_number > 7 ) {
         std::ostringstream s;
         s << "(update) Invalid palette_: " << palette_number;
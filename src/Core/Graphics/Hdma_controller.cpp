@@ -47,4 +47,18 @@ namespace gb::graphics {
             }
         }
     }
-}
\ No newline at end of file
+
+    void Hdma_controller::save_state(State_writer &out) const {
+        out.write(hdma_src_.val);
+        out.write(hdma_dst_.val);
+        out.write(hdma_len_mode_.val);
+        out.write(hdma_running_);
+    }
+
+    void Hdma_controller::load_state(State_reader &in) {
+        in.read(hdma_src_.val);
+        in.read(hdma_dst_.val);
+        in.read(hdma_len_mode_.val);
+        in.read(hdma_running_);
+    }
+}
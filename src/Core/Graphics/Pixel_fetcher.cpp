@@ -9,6 +9,7 @@ namespace gb::graphics {
     Ppu::Pixel_fetcher::Pixel_fetcher(Ppu &ppu) :
             ppu_{ppu},
             spr_{},
+            bg_tile_attributes_{},
             fetcher_state_{Pixel_fetcher_state::get_tile},
             tile_row_index_{0},
             tile_index_{0},
@@ -18,14 +19,8 @@ namespace gb::graphics {
             sprite_tile_index_{0},
             sprite_tile_y{0},
             rendering_sprites_(false),
-            dot_clock_divider_{0},
-            state_callbacks_{}
+            dot_clock_divider_{0}
     {
-        initialize_state_callbacks();
-    }
-
-    void Ppu::Pixel_fetcher::step() {
-        state_callbacks_[fetcher_state_]();
     }
 
     void Ppu::Pixel_fetcher::reset(uint8_t x, uint8_t y, bool r_window) {
@@ -68,30 +63,14 @@ namespace gb::graphics {
         spr_ = s;
     }
 
-    void Ppu::Pixel_fetcher::initialize_state_callbacks() {
-        state_callbacks_[Pixel_fetcher_state::get_tile]
-                = [this]() { get_tile(); };
-
-        state_callbacks_[Pixel_fetcher_state::get_tile_data_low]
-                = [this]() { get_tile_data_lo(); };
-
-        state_callbacks_[Pixel_fetcher_state::get_tile_data_high]
-                = [this]() { get_tile_data_hi(); };
-
-        state_callbacks_[Pixel_fetcher_state::sleep]
-                = [this]() { sleep(); };
-
-        state_callbacks_[Pixel_fetcher_state::push]
-                = [this]() { push(); };
-    }
-
+    template<bool Cgb>
     void Ppu::Pixel_fetcher::get_tile() {
         if ( step_dot_divider() ) {
             if ( !rendering_sprites_ ) {
                 tile_index_ = static_cast<int>(ppu_.vram_[tile_row_addr_ + tile_row_index_]);
                 if (!ppu_.lcdc_.bg_window_tile_data)
                     tile_index_ = ((int8_t) tile_index_) + 256;
-                if ( ppu_.gb_.is_cgb_ ) {
+                if constexpr ( Cgb ) {
                     bg_tile_attributes_.val = ppu_.vram_[0x2000 + tile_row_addr_ + tile_row_index_];
                 } else {
                     bg_tile_attributes_.val = 0;
@@ -101,11 +80,6 @@ namespace gb::graphics {
         }
     }
 
-    void Ppu::Pixel_fetcher::get_tile_data_lo() {
-        if ( step_dot_divider() )
-            fetcher_state_ = Pixel_fetcher_state::get_tile_data_high;
-    }
-
     void Ppu::Pixel_fetcher::get_tile_data_hi() {
         if ( step_dot_divider() ) {
             if ( !rendering_sprites_ )
@@ -115,11 +89,7 @@ namespace gb::graphics {
         }
     }
 
-    void Ppu::Pixel_fetcher::sleep() {
-        if ( step_dot_divider() )
-            fetcher_state_ = Pixel_fetcher_state::push;
-    }
-
+    template<bool Cgb>
     void Ppu::Pixel_fetcher::push() {
         if ( !rendering_sprites_ ) {
             if (ppu_.bg_fifo_.size() <= 8) {
@@ -129,9 +99,9 @@ namespace gb::graphics {
                     scroll_pixels_--;
                 }
                 while (tile_x >= 0) {
-                    if ( !ppu_.gb_.is_cgb_ )
-                        ppu_.bg_fifo_.push(ppu_.tileset_[tile_index_].get_color(tile_x, tile_y_));
-                    else {
+                    if constexpr ( !Cgb ) {
+                        ppu_.bg_fifo_.push_back(ppu_.tileset_[tile_index_].get_color(tile_x, tile_y_));
+                    } else {
                         auto& tileset = bg_tile_attributes_.vram_bank == 0 ? ppu_.tileset_ : ppu_.tileset_bank1_;
                         uint8_t _x = bg_tile_attributes_.x_flip ? (7 - tile_x) : tile_x;
                         uint8_t _y = bg_tile_attributes_.y_flip ? (7 - tile_y_) : tile_y_;
@@ -141,7 +111,7 @@ namespace gb::graphics {
                                 bg_tile_attributes_.priority,
                                 bg_tile_attributes_.pal_number
                         };
-                        ppu_.bg_fifo_.push(_p);
+                        ppu_.bg_fifo_.push_back(_p);
                     }
                     tile_x--;
                 }
@@ -159,7 +129,7 @@ namespace gb::graphics {
                             spr_.oam_offset
                     };
 
-                    if ( ppu_.gb_.is_cgb_ ) {
+                    if constexpr ( Cgb ) {
                         p = {((spr_.attributes & 8) ? ppu_.tileset_bank1_ : ppu_.tileset_)[sprite_tile_index_].get_color(((spr_.attributes >> 5) & 1) ? tile_x : (7 - tile_x), sprite_tile_y),
                              static_cast<uint8_t>(spr_.attributes & 7),
                              static_cast<uint8_t>((spr_.attributes >> 7) & 1),
@@ -168,7 +138,7 @@ namespace gb::graphics {
                     if (ppu_.spr_fifo_.size() <= tile_x ) {
                         ppu_.spr_fifo_.push_back(p);
                     } else {
-                        if (ppu_.spr_fifo_.at(tile_x).color_ == 0 || ((ppu_.gb_.is_cgb_) && spr_.oam_offset < ppu_.spr_fifo_.at(tile_x).oam_offset_) )
+                        if (ppu_.spr_fifo_[tile_x].color_ == 0 || (Cgb && spr_.oam_offset < ppu_.spr_fifo_[tile_x].oam_offset_) )
                             ppu_.spr_fifo_[tile_x] = p;
                     }
                 }
@@ -177,4 +147,39 @@ namespace gb::graphics {
         }
         fetcher_state_ = Pixel_fetcher_state::get_tile;
     }
-}
\ No newline at end of file
+
+    template void Ppu::Pixel_fetcher::get_tile<false>();
+    template void Ppu::Pixel_fetcher::get_tile<true>();
+    template void Ppu::Pixel_fetcher::push<false>();
+    template void Ppu::Pixel_fetcher::push<true>();
+
+    void Ppu::Pixel_fetcher::save_state(State_writer &out) const {
+        out.write(spr_);
+        out.write(bg_tile_attributes_.val);
+        out.write(fetcher_state_);
+        out.write(tile_row_index_);
+        out.write(tile_index_);
+        out.write(tile_row_addr_);
+        out.write(tile_y_);
+        out.write(scroll_pixels_);
+        out.write(sprite_tile_index_);
+        out.write(sprite_tile_y);
+        out.write(rendering_sprites_);
+        out.write(dot_clock_divider_);
+    }
+
+    void Ppu::Pixel_fetcher::load_state(State_reader &in) {
+        in.read(spr_);
+        in.read(bg_tile_attributes_.val);
+        in.read(fetcher_state_);
+        in.read(tile_row_index_);
+        in.read(tile_index_);
+        in.read(tile_row_addr_);
+        in.read(tile_y_);
+        in.read(scroll_pixels_);
+        in.read(sprite_tile_index_);
+        in.read(sprite_tile_y);
+        in.read(rendering_sprites_);
+        in.read(dot_clock_divider_);
+    }
+}
@@ -4,12 +4,15 @@
 
 #include <Core/Graphics/Ppu.h>
 #include <Core/Gameboy.h>
+#include <limits>
 #include <map>
 #include <ranges>
 #include <span>
+#include <sstream>
 
 #include "Core/Memory/Address_space.h"
 #include "Core/Cpu/Interrupts.h"
+#include "Logger/Logger.h"
 #include "Tile.h"
 
 namespace {
@@ -17,6 +20,8 @@ namespace {
     constexpr uint16_t oam_size = 0xA0;
     constexpr uint32_t mono_palette[] { 0xFFFFFFFF, 0xFFCCCCCC, 0xFF777777, 0xFF000000 };
     constexpr uint8_t lcd_stat_lyc_flag = 4;
+    // Dots pixel transfer takes through the FIFO when there's nothing but the background on the line, by SCX & 7
+    constexpr uint16_t whole_line_dots[] { 192, 193, 193, 194, 195, 196, 197, 198 };
     
     enum Lcd_status_int_masks: uint8_t {
         hblank = 0x8,
@@ -33,11 +38,13 @@ namespace {
 }
 // Public methods
 gb::graphics::Ppu::Ppu(gb::Gameboy &pGB, std::shared_ptr<cpu::Interrupts> interrupts)
-        : state_(Ppu_state::oam_search), gb_(pGB), interrupts_(std::move(interrupts)), pixel_fetcher_(*this), bg_fifo_{},
-          spr_fifo_{}, oam_(oam_size), vram_(vram_bank_size << (pGB.is_cgb_ ? 1 : 0)), hdma_ctrl_{pGB} {
+        : state_(Ppu_state::oam_search), gb_(pGB), interrupts_(std::move(interrupts)), synced_(pGB.scheduler_.now()),
+          pixel_fetcher_(*this), oam_(oam_size), vram_(vram_bank_size << (pGB.is_cgb_ ? 1 : 0)),
+          screen_(frames_.back().data()), finished_(frames_.latest().data()), hdma_ctrl_{pGB} {
     reset();
-    tileset_.reserve(384);
-    tileset_bank1_.reserve(384);
+    tileset_.resize(384);
+    tileset_bank1_.resize(384);
+    schedule_next_event();
 }
 
 void gb::graphics::Ppu::reset() {
@@ -64,7 +71,84 @@ void gb::graphics::Ppu::reset() {
 //
 //    }
 }
+void gb::graphics::Ppu::sync() {
+    sync(gb_.scheduler_.now());
+}
+
+void gb::graphics::Ppu::sync(uint64_t time) {
+    // Moving synced_ first turns the syncs coming from inside step (HDMA writing to VRAM) into no-ops
+    if ( time <= synced_ )
+        return;
+    auto cycles = static_cast<unsigned int>(time - synced_);
+    synced_ = time;
+    step(cycles);
+    // Catching up short of the pending event leaves it where it was, reaching it (or having just popped it) moves it on
+    if ( !gb_.scheduler_.is_scheduled(Scheduler::ppu) || synced_ >= gb_.scheduler_.time_of(Scheduler::ppu) )
+        schedule_next_event();
+}
+
+uint64_t gb::graphics::Ppu::stable_until(uint16_t addr) {
+    sync();
+    if ( !lcdc_.lcd_enable )
+        return std::numeric_limits<uint64_t>::max();
+    uint64_t line_end = synced_ + (456 - scanline_counter_);
+    if ( addr == Gpu_reg_location::ly )
+        return line_end;
+    // STAT changes with the mode and with the LYC flag, which only moves at line boundaries. Pixel transfer pushes one
+    // pixel per dot at most
+    switch ( state_ ) {
+        case Ppu_state::oam_search:
+            return synced_ + (80 - scanline_counter_);
+        case Ppu_state::pixel_transfer:
+            if ( whole_line_ )
+                return synced_ + (whole_line_end_ - scanline_counter_);
+            return synced_ + (160 - current_pixel_);
+        default:
+            return line_end;
+    }
+}
+
+/* Next dot at which the Ppu does something the rest of the machine can see without asking: raising an interrupt
+ * (vblank, LYC coincidence, the STAT mode interrupts that are enabled) or copying a block of HBlank DMA. Everything
+ * else waits for the next register, VRAM or OAM access. Line boundaries are 456 dots apart no matter how long pixel
+ * transfer takes, HBlank doesn't have a known start though, so its interrupt is scheduled where the line could end at
+ * the earliest and pushed further every time it turns out it didn't. */
+void gb::graphics::Ppu::schedule_next_event() {
+    if ( !lcdc_.lcd_enable ) {
+        gb_.scheduler_.cancel(Scheduler::ppu);
+        return;
+    }
+
+    if ( (lcd_stat_ & Lcd_status_int_masks::hblank) ) {
+        if ( state_ == Ppu_state::oam_search ) {
+            gb_.scheduler_.schedule(Scheduler::ppu, synced_ + (80 - scanline_counter_) + 160);
+            return;
+        }
+        if ( state_ == Ppu_state::pixel_transfer ) {
+            gb_.scheduler_.schedule(Scheduler::ppu, synced_ + (whole_line_ ? whole_line_end_ - scanline_counter_
+                                                                             : 160 - current_pixel_));
+            return;
+        }
+    }
+
+    uint64_t boundary = synced_ + (456 - scanline_counter_);
+    uint8_t line = ly_;
+    while ( true ) {
+        bool hdma = hdma_ctrl_.is_running() && line < 144;
+        line = (line + 1) % 154;
+        if ( hdma || line == lyc_ || line == 144 || (line < 144 && (lcd_stat_ & Lcd_status_int_masks::oam)) )
+            break;
+        if ( line < 144 && (lcd_stat_ & Lcd_status_int_masks::hblank) ) {
+            boundary += 80 + 160;
+            break;
+        }
+        boundary += 456;
+    }
+    gb_.scheduler_.schedule(Scheduler::ppu, boundary);
+}
+
 uint8_t gb::graphics::Ppu::read(uint16_t addr) {
+    sync();
     switch (addr) {
         case Gpu_reg_location::lcd_control:   return lcdc_.val;
         case Gpu_reg_location::lcd_status:    return lcd_stat_;
@@ -94,14 +178,19 @@ uint8_t gb::graphics::Ppu::read(uint16_t addr) {
 }
 
 void gb::graphics::Ppu::send(uint16_t addr, uint8_t val) {
+    sync();
+    if ( whole_line_ )
+        fall_back_to_fifo();
     switch(addr) {
         case Gpu_reg_location::lcd_control:
             lcdc_.val = val;
             if ( !lcdc_.lcd_enable )
                 disable_lcd();
+            schedule_next_event();
             break;
         case Gpu_reg_location::lcd_status:
             lcd_stat_ = 0x80 | val;
+            schedule_next_event();
             break;
         case Gpu_reg_location::scroll_y:
             scroll_y_ = val;
@@ -114,6 +203,7 @@ void gb::graphics::Ppu::send(uint16_t addr, uint8_t val) {
             break;
         case Gpu_reg_location::lyc:
             lyc_ = val;
+            schedule_next_event();
             break;
         case Gpu_reg_location::bg_palette:
             if ( !gb_.is_cgb_ ) {
@@ -140,7 +230,11 @@ void gb::graphics::Ppu::send(uint16_t addr, uint8_t val) {
             window_x_ = val;
             break;
         case Gpu_reg_location::vram_bank_sel:
+            // A DMG only has the one bank
+            if ( !gb_.is_cgb_ )
+                break;
             vram_bank_ = val & 1;
+            gb_.mmu_->map_vram();
             break;
         case Gpu_reg_location::hdma_src_msb:
             hdma_ctrl_.hdma_src_.msb = val;
@@ -156,6 +250,7 @@ void gb::graphics::Ppu::send(uint16_t addr, uint8_t val) {
             break;
         case Gpu_reg_location::hdma_len:
             hdma_ctrl_.set_length(val);
+            schedule_next_event();
             break;
         case Gpu_reg_location::bcps:
             bcps_.val = val;
@@ -179,14 +274,26 @@ void gb::graphics::Ppu::send(uint16_t addr, uint8_t val) {
             opri_ = val;
             break;
         default:
-            std::ostringstream s("Write to unknown Ppu register at $");
-            s << std::hex << addr;
-            s << " value 0x" << std::hex << val;
-            std::cout << s.str() << std::endl;
+            std::ostringstream s;
+            s << "Write to unknown Ppu register at $" << std::hex << addr << " value 0x" << static_cast<int>(val);
+            Logger::warning("Ppu", s.str());
             break;
     }
 }
 
+// Runs dots until pixel transfer is over or cycles run out, returns the cycles left
+template<bool Cgb>
+unsigned int gb::graphics::Ppu::run_pixel_transfer(unsigned int cycles) {
+    while ( cycles > 0 && state_ == Ppu_state::pixel_transfer ) {
+        render_pixel<Cgb>();
+        pixel_fetcher_.step<Cgb>();
+        scanline_counter_++;
+        cycles--;
+    }
+    return cycles;
+}
+
+template<bool Cgb>
 void gb::graphics::Ppu::render_pixel() {
     if ( pixel_fetcher_.is_rendering_sprites() )
         return;
@@ -208,19 +315,18 @@ void gb::graphics::Ppu::render_pixel() {
         uint8_t x_ = current_pixel_ - (window_x_ - 7);
         uint8_t y_ = internal_window_counter_;
         pixel_fetcher_.reset(x_, y_, true);
-        while ( !bg_fifo_.empty() )
-            bg_fifo_.pop();
+        bg_fifo_.clear();
         return;
     }
 
     if ( bg_fifo_.size() >= 8 ) {
-        Tile_pixel bg_pixel = (gb_.is_cgb_ || lcdc_.bg_window_enable_priority) && enable_bg_ ? bg_fifo_.front() : 0;
+        Tile_pixel bg_pixel = (Cgb || lcdc_.bg_window_enable_priority) && enable_bg_ ? bg_fifo_.front() : 0;
         uint8_t color_ = bg_pixel.color_;
-        uint32_t *pal = gb_.is_cgb_ ? bcpd_.get_palette(bg_pixel.palette_) : bg_pal_colors_;
+        uint32_t *pal = Cgb ? bcpd_.get_palette(bg_pixel.palette_) : bg_pal_colors_;
         if ( !spr_fifo_.empty() ) {
             Sprite_pixel spr_pixel = spr_fifo_.front();
             if ( spr_pixel.color_ != 0 ) {
-                if ( gb_.is_cgb_ ) {
+                if constexpr ( Cgb ) {
                     if (!lcdc_.bg_window_enable_priority || (!bg_pixel.priority_ && !spr_pixel.priority_) || bg_pixel.color_ == 0 ) {
                         color_ = spr_pixel.color_;
                         pal = ocpd_.get_palette(spr_pixel.palette_);
@@ -236,7 +342,7 @@ void gb::graphics::Ppu::render_pixel() {
         }
 
         screen_[ly_ * 160 + current_pixel_] = pal[color_];
-        bg_fifo_.pop();
+        bg_fifo_.pop_front();
         current_pixel_++;
         if (current_pixel_ == 160) {
             current_pixel_ = 0;
@@ -247,66 +353,274 @@ void gb::graphics::Ppu::render_pixel() {
     }
 }
 
+bool gb::graphics::Ppu::can_draw_whole_line() const {
+    bool sprites = lcdc_.obj_enable && enable_sprites_ && !sprites_.empty();
+    // The window starts as soon as the pixel it begins at comes up, and they all come up on a line
+    bool window = lcdc_.window_enable && enable_window_ && window_y_ <= ly_ && window_y_ <= 143 && window_x_ <= 166;
+    // Turning the LCD off halfway through a line leaves the next one to start from where that one was cut short
+    return !sprites && !window && current_pixel_ == 0;
+}
+
+// Same pixels the FIFO pushes for the background alone: the row of tiles from SCX on, the first SCX & 7 pixels dropped
+template<bool Cgb>
+void gb::graphics::Ppu::draw_whole_line() {
+    uint32_t *line = screen_ + ly_ * 160;
+    if ( !((Cgb || lcdc_.bg_window_enable_priority) && enable_bg_) ) {
+        std::fill_n(line, 160, (Cgb ? bcpd_.get_palette(0) : bg_pal_colors_)[0]);
+        return;
+    }
+
+    uint8_t y = ly_ + scroll_y_;
+    uint16_t row_addr = (lcdc_.bg_tile_map ? 0x1C00 : 0x1800) + ((y >> 3) << 5);
+    uint8_t tile_y = y & 7;
+    uint8_t column = scroll_x_ >> 3;
+    int first = scroll_x_ & 7;
+    for ( int x = 0; x < 160; column = (column + 1) & 0x1F ) {
+        int tile_index = vram_[row_addr + column];
+        if ( !lcdc_.bg_window_tile_data )
+            tile_index = static_cast<int8_t>(tile_index) + 256;
+
+        const Tile *tile = &tileset_[tile_index];
+        const uint32_t *pal = bg_pal_colors_;
+        bool x_flip = false;
+        uint8_t row = tile_y;
+        if constexpr ( Cgb ) {
+            cgb_tile_attributes_t attributes{};
+            attributes.val = vram_[0x2000 + row_addr + column];
+            tile = &(attributes.vram_bank ? tileset_bank1_ : tileset_)[tile_index];
+            pal = bcpd_.get_palette(attributes.pal_number);
+            x_flip = attributes.x_flip;
+            row = attributes.y_flip ? 7 - tile_y : tile_y;
+        }
+        // Tiles keep their leftmost pixel in column 7
+        for ( int pixel = first; pixel < 8 && x < 160; pixel++, x++ )
+            line[x] = pal[tile->get_color(x_flip ? pixel : 7 - pixel, row)];
+        first = 0;
+    }
+}
+
+void gb::graphics::Ppu::fall_back_to_fifo() {
+    whole_line_ = false;
+    auto dots = static_cast<unsigned int>(scanline_counter_ - 80);
+    scanline_counter_ = 80;
+    gb_.is_cgb_ ? run_pixel_transfer<true>(dots) : run_pixel_transfer<false>(dots);
+}
+
+// Only pixel transfer has to go dot by dot, every other mode just counts dots up to its next transition
 void gb::graphics::Ppu::step(unsigned int cycles) {
     if ( !lcdc_.lcd_enable ) {
         return;
     }
 
-    while ( cycles-- > 0 ) {
+    while ( cycles > 0 ) {
+        unsigned int dots;
         switch (state_) {
             case Ppu_state::hblank:
-                if ( advance_scanline_counter() == 0 ) {
-                    if (hdma_ctrl_.is_running())
-                        hdma_ctrl_.step();
-
-                    if ( advance_scanline() == 144 ) {
-                        update_state(Ppu_state::vblank);
-                        interrupts_->request(cpu::Interrupts::v_blank);
-                    } else {
-                        update_state(Ppu_state::oam_search);
-                    }
+                dots = 456 - scanline_counter_;
+                if ( cycles < dots ) {
+                    scanline_counter_ += cycles;
+                    return;
+                }
+                cycles -= dots;
+                scanline_counter_ = 0;
+                if (hdma_ctrl_.is_running())
+                    hdma_ctrl_.step();
+
+                if ( advance_scanline() == 144 ) {
+                    update_state(Ppu_state::vblank);
+                    interrupts_->request(cpu::Interrupts::v_blank);
+                    frame_ready_ = true;
+                    finished_ = screen_;
+                    if ( publish_frames_ )
+                        publish_frame();
+                } else {
+                    update_state(Ppu_state::oam_search);
                 }
                 break;
             case Ppu_state::vblank:
-                if ( advance_scanline_counter() == 0 ) {
-                    if ( advance_scanline() == 0 ) {
-                        internal_window_counter_ = 0;
-                        update_state(Ppu_state::oam_search);
-                    }
+                dots = 456 - scanline_counter_;
+                if ( cycles < dots ) {
+                    scanline_counter_ += cycles;
+                    return;
+                }
+                cycles -= dots;
+                scanline_counter_ = 0;
+                if ( advance_scanline() == 0 ) {
+                    internal_window_counter_ = 0;
+                    update_state(Ppu_state::oam_search);
                 }
                 break;
             case Ppu_state::pixel_transfer:
-                render_pixel();
-                pixel_fetcher_.step();
-                scanline_counter_++;
+                if ( whole_line_ ) {
+                    dots = whole_line_end_ - scanline_counter_;
+                    if ( cycles < dots ) {
+                        scanline_counter_ += cycles;
+                        return;
+                    }
+                    cycles -= dots;
+                    scanline_counter_ = whole_line_end_;
+                    whole_line_ = false;
+                    gb_.is_cgb_ ? draw_whole_line<true>() : draw_whole_line<false>();
+                    update_state(Ppu_state::hblank);
+                    break;
+                }
+                cycles = gb_.is_cgb_ ? run_pixel_transfer<true>(cycles) : run_pixel_transfer<false>(cycles);
                 break;
             case Ppu_state::oam_search:
-                if (advance_scanline_counter() == 80 ) {
-                    sprites_.clear();
-                    for (uint8_t i = 0; i < oam_size && sprites_.size() < 10; i += 4 ) {
-                        Sprite x{i, oam_[i], oam_[i + 1], oam_[i + 2], oam_[i + 3], false};
-                        if ((ly_ + 16 >= x.y) && (ly_ + 16 < (x.y + (lcdc_.obj_size ? 16 : 8))) ) {
-                            sprites_.push_back(x);
-                        }
+                dots = 80 - scanline_counter_;
+                if ( cycles < dots ) {
+                    scanline_counter_ += cycles;
+                    return;
+                }
+                cycles -= dots;
+                scanline_counter_ = 80;
+
+                sprites_.clear();
+                for (uint8_t i = 0; i < oam_size && sprites_.size() < 10; i += 4 ) {
+                    Sprite x{i, oam_[i], oam_[i + 1], oam_[i + 2], oam_[i + 3], false};
+                    if ((ly_ + 16 >= x.y) && (ly_ + 16 < (x.y + (lcdc_.obj_size ? 16 : 8))) ) {
+                        sprites_.push_back(x);
                     }
-                    std::stable_sort(sprites_.begin(), sprites_.end(), [](Sprite a, Sprite b) {
-                        return a.x <= b.x;
-                    });
-
-                    uint8_t x_, y_;
-                    x_ = scroll_x_;
-                    y_ = ly_ + scroll_y_;
-                    rendering_window_ = false;
-                    pixel_fetcher_.reset(x_, y_, false);
-                    while ( !bg_fifo_.empty() ) bg_fifo_.pop();
-                    while ( !spr_fifo_.empty() ) spr_fifo_.pop_front();
-                    update_state(Ppu_state::pixel_transfer);
                 }
+                std::stable_sort(sprites_.begin(), sprites_.end(), [](Sprite a, Sprite b) {
+                    return a.x <= b.x;
+                });
+
+                uint8_t x_, y_;
+                x_ = scroll_x_;
+                y_ = ly_ + scroll_y_;
+                rendering_window_ = false;
+                pixel_fetcher_.reset(x_, y_, false);
+                bg_fifo_.clear();
+                spr_fifo_.clear();
+                whole_line_ = can_draw_whole_line();
+                whole_line_end_ = 80 + whole_line_dots[scroll_x_ & 7];
+                update_state(Ppu_state::pixel_transfer);
                 break;
         }
     }
 }
 
+void gb::graphics::Ppu::publish_frame() {
+    if ( finished_ == loaded_frame_.data() ) {
+        /* A state was loaded since the last VBlank: the finished frame sits in loaded_frame_, the back slot holds the
+         * one in progress. The two trade places so the finished one can be published, and the one in progress moves on
+         * to the next back slot. */
+        std::swap(frames_.back(), loaded_frame_);
+        frames_.publish();
+        frames_.back() = loaded_frame_;
+    } else {
+        frames_.publish();
+    }
+    screen_ = frames_.back().data();
+    finished_ = frames_.latest().data();
+}
+
+void gb::graphics::Ppu::save_state(State_writer &out) const {
+    out.write(state_);
+    out.write(synced_);
+    out.write_vector(sprites_);
+    // Decoded tiles are copied rather than rebuilt from VRAM, which would take much longer
+    out.write_vector(tileset_);
+    out.write_vector(tileset_bank1_);
+
+    pixel_fetcher_.save_state(out);
+    out.write(static_cast<uint32_t>(bg_fifo_.size()));
+    for ( uint8_t i = 0; i < bg_fifo_.size(); i++ )
+        out.write(bg_fifo_[i]);
+    out.write(static_cast<uint32_t>(spr_fifo_.size()));
+    for ( uint8_t i = 0; i < spr_fifo_.size(); i++ )
+        out.write(spr_fifo_[i]);
+
+    oam_.save_state(out);
+    vram_.save_state(out);
+    // Only the lines of the frame in progress drawn so far, the rest of the back slot is left over from an older frame
+    uint8_t lines = state_ == Ppu_state::vblank ? 0 : std::min(ly_ + 1, 144);
+    out.write(lines);
+    out.write_bytes(screen_, lines * 160 * sizeof(uint32_t));
+    out.write_bytes(finished_, sizeof(Frame));
+
+    out.write(lcdc_.val);
+    out.write(lcd_stat_);
+    out.write(scroll_x_);
+    out.write(scroll_y_);
+    out.write(ly_);
+    out.write(lyc_);
+    out.write(window_x_);
+    out.write(window_y_);
+    out.write(bg_pal_);
+    out.write(obj0_pal_);
+    out.write(obj1_pal_);
+    out.write(vram_bank_);
+
+    out.write(rendering_window_);
+    out.write(internal_window_counter_);
+    out.write(scanline_counter_);
+    out.write(current_pixel_);
+    out.write(whole_line_);
+    out.write(whole_line_end_);
+
+    hdma_ctrl_.save_state(out);
+    out.write(bcps_.val);
+    out.write(bcpd_);
+    out.write(ocps_.val);
+    out.write(ocpd_);
+    out.write(opri_);
+}
+
+void gb::graphics::Ppu::load_state(State_reader &in) {
+    in.read(state_);
+    in.read(synced_);
+    in.read_vector(sprites_);
+    in.read_vector(tileset_);
+    in.read_vector(tileset_bank1_);
+
+    pixel_fetcher_.load_state(in);
+    bg_fifo_.clear();
+    for ( auto n = in.read<uint32_t>(); n > 0 && !in.failed(); n-- )
+        bg_fifo_.push_back(in.read<Tile_pixel>());
+    spr_fifo_.clear();
+    for ( auto n = in.read<uint32_t>(); n > 0 && !in.failed(); n-- )
+        spr_fifo_.push_back(in.read<Sprite_pixel>());
+
+    oam_.load_state(in);
+    vram_.load_state(in);
+    auto lines = std::min<uint8_t>(in.read<uint8_t>(), 144);
+    in.read_bytes(screen_, lines * 160 * sizeof(uint32_t));
+    in.read(loaded_frame_);
+    finished_ = loaded_frame_.data();
+
+    in.read(lcdc_.val);
+    in.read(lcd_stat_);
+    in.read(scroll_x_);
+    in.read(scroll_y_);
+    in.read(ly_);
+    in.read(lyc_);
+    in.read(window_x_);
+    in.read(window_y_);
+    in.read(bg_pal_);
+    in.read(obj0_pal_);
+    in.read(obj1_pal_);
+    in.read(vram_bank_);
+    update_palette_colors_gb(bg_pal_colors_, bg_pal_);
+    update_palette_colors_gb(obj0_pal_colors_, obj0_pal_);
+    update_palette_colors_gb(obj1_pal_colors_, obj1_pal_);
+
+    in.read(rendering_window_);
+    in.read(internal_window_counter_);
+    in.read(scanline_counter_);
+    in.read(current_pixel_);
+    in.read(whole_line_);
+    in.read(whole_line_end_);
+
+    hdma_ctrl_.load_state(in);
+    in.read(bcps_.val);
+    in.read(bcpd_);
+    in.read(ocps_.val);
+    in.read(ocpd_);
+    in.read(opri_);
+}
+
 uint8_t gb::graphics::Ppu::read_vram(uint16_t addr) {
 //    if ( state_ == Ppu_state::pixel_transfer ) {
 //        return 0xFF;
@@ -316,6 +630,7 @@ uint8_t gb::graphics::Ppu::read_vram(uint16_t addr) {
 }
 
 void gb::graphics::Ppu::write_vram(uint16_t addr, uint8_t val) {
+    sync();
     if ( state_ == Ppu_state::pixel_transfer )
         return;
     uint16_t a = 0x2000 * (vram_bank_ & 1) + addr;
@@ -330,10 +645,12 @@ void gb::graphics::Ppu::write_vram(uint16_t addr, uint8_t val) {
 }
 
 void gb::graphics::Ppu::update_state(Ppu_state new_state) {
+    // Pixel transfer has no STAT interrupt
     static uint8_t interrupt_masks[] {
             Lcd_status_int_masks::hblank,
             Lcd_status_int_masks::vblank,
             Lcd_status_int_masks::oam,
+            0
     };
 
     state_ = new_state;
@@ -365,6 +682,7 @@ uint16_t gb::graphics::Ppu::advance_scanline_counter() {
 }
 
 void gb::graphics::Ppu::disable_lcd() {
+    whole_line_ = false;
     scanline_counter_ = 0;
     ly_ = 0;
     lcd_stat_ &= 0xFC;
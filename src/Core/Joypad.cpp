@@ -148,3 +148,13 @@ bool Joypad::is_pressed(Joypad::key_e key) const {
             return false;
     }
 }
+
+void Joypad::save_state(gb::State_writer &out) const {
+    out.write(m_dir_selected);
+    out.write(m_buttons_selected);
+}
+
+void Joypad::load_state(gb::State_reader &in) {
+    in.read(m_dir_selected);
+    in.read(m_buttons_selected);
+}
@@ -49,4 +49,22 @@ namespace gb::memory {
             _c -= 4;
         }
     }
-}
\ No newline at end of file
+
+    void Memory::Dma_controller::save_state(State_writer &out) const {
+        out.write(mem_index_);
+        out.write(dma_addr_);
+        out.write(dma_completed_);
+        out.write(dma_index_);
+        out.write(dma_trigger_);
+        out.write(dma_wait_);
+    }
+
+    void Memory::Dma_controller::load_state(State_reader &in) {
+        in.read(mem_index_);
+        in.read(dma_addr_);
+        in.read(dma_completed_);
+        in.read(dma_index_);
+        in.read(dma_trigger_);
+        in.read(dma_wait_);
+    }
+}
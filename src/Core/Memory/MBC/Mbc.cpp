@@ -6,10 +6,7 @@
 #include <cstdint>
 #include <memory>
 
-#include "Core/Memory/MBC/Mbc1.h"
-#include "Core/Memory/MBC/Mbc3.h"
-#include "Core/Memory/MBC/Mbc5.h"
-#include "Core/Memory/MBC/None.h"
+#include "Core/Memory/MBC/Cartridge.h"
 #include "Core/Memory/MBC/RTC.h"
 #include "Core/Memory/Rom.h"
 
@@ -48,6 +45,8 @@ Mbc::Mbc(std::filesystem::path& rom_path, bool battery, bool rtc, bool has_ram,
          unsigned int ram_banks) :
           rom_(rom_path, 0x4000 * rom_banks),
           ram_(ram_size_map[ram_banks]),
+          latch(0),
+          rtc_clock(),
           rom_path_(rom_path),
           has_battery_(battery),
           has_rtc_(rtc),
@@ -56,6 +55,7 @@ Mbc::Mbc(std::filesystem::path& rom_path, bool battery, bool rtc, bool has_ram,
           ram_banks_n(ram_banks),
           banking_mode_(rom_mode),
           cgb(rom_.read(0x143)) {
+    map_banks(0, 1);
     std::ifstream in {rom_path.replace_extension(".sav")};
     if ( has_battery_ ) {
         ram_.load_from_savfile(in);
@@ -65,7 +65,21 @@ Mbc::Mbc(std::filesystem::path& rom_path, bool battery, bool rtc, bool has_ram,
     }
 }
 
-std::unique_ptr<Mbc> gb::memory::mbc::make_mbc(std::filesystem::path& rom_path) {
+void Mbc::save_state(gb::State_writer &out) const {
+    ram_.save_state(out);
+    out.write(latch);
+    out.write(rtc_clock);
+    out.write(banking_mode_);
+}
+
+void Mbc::load_state(gb::State_reader &in) {
+    ram_.load_state(in);
+    in.read(latch);
+    in.read(rtc_clock);
+    in.read(banking_mode_);
+}
+
+std::unique_ptr<gb::memory::mbc::Cartridge> gb::memory::mbc::make_mbc(std::filesystem::path& rom_path) {
     cartridge_header cart_hdr{};
 
     std::ifstream rom_file { rom_path.c_str(), std::ios::binary };
@@ -82,28 +96,28 @@ std::unique_ptr<Mbc> gb::memory::mbc::make_mbc(std::filesystem::path& rom_path)
 
     switch (cart_hdr.cart_type) {
         case mbc_type::NONE:
-            return std::make_unique<None>(rom_path);
+            return std::make_unique<Cartridge>(std::in_place_type<None>, rom_path);
 
         case mbc_type::MBC1_RB:     battery = true; [[fallthrough]];
         case mbc_type::MBC1_R:      has_ram = true; [[fallthrough]];
         case mbc_type::MBC1:
-            return std::make_unique<Mbc1>(rom_path, battery, has_ram, rom_banks_n, ram_banks_n);
+            return std::make_unique<Cartridge>(std::in_place_type<Mbc1>, rom_path, battery, has_ram, rom_banks_n, ram_banks_n);
 
         case mbc_type::MBC3_TRB:    has_ram = true; [[fallthrough]];
         case mbc_type::MBC3_TB:     timer = true; battery = true;
-            return std::make_unique<Mbc3>(rom_path, battery, has_ram, timer, rom_banks_n, ram_banks_n);
+            return std::make_unique<Cartridge>(std::in_place_type<Mbc3>, rom_path, battery, has_ram, timer, rom_banks_n, ram_banks_n);
 
         case mbc_type::MBC3_RB:     battery = true; [[fallthrough]];
         case mbc_type::MBC3_R:      has_ram = true; [[fallthrough]];
         case mbc_type::MBC3:
-            return std::make_unique<Mbc3>(rom_path, battery, has_ram, timer, rom_banks_n, ram_banks_n);
+            return std::make_unique<Cartridge>(std::in_place_type<Mbc3>, rom_path, battery, has_ram, timer, rom_banks_n, ram_banks_n);
 
         case mbc_type::MBC5_RB:     battery = true; [[fallthrough]];
         case mbc_type::MBC5_R:      has_ram = true; [[fallthrough]];
         case mbc_type::MBC5:
-            return std::make_unique<Mbc5>(rom_path, battery, has_ram, rom_banks_n, ram_banks_n);
+            return std::make_unique<Cartridge>(std::in_place_type<Mbc5>, rom_path, battery, has_ram, rom_banks_n, ram_banks_n);
 
         default:
-            return std::make_unique<None>(rom_path);
+            return std::make_unique<Cartridge>(std::in_place_type<None>, rom_path);
     }
 }
\ No newline at end of file
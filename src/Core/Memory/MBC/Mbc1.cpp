@@ -23,17 +23,13 @@ void Mbc1::write(uint16_t addr, uint8_t val) {
         mRomBankHi = val & 0x3;
     if ( addr >= 0x6000 && addr <= 0x7FFF )
         banking_mode_ = val == 0 ? rom_mode : ram_mode;
+    if ( addr >= 0x2000 )
+        update_banks();
 }
 
-uint8_t Mbc1::read(uint16_t addr) {
-    unsigned int bank_offset = addr < 0x4000 ? 0 : ( ( (mRomBankHi << 5) | mRomBankLo) & 0x7F);
-    if ( bank_offset == 0 && banking_mode_ == ram_mode )
-        bank_offset = mRomBankHi << 5;
-
-    bank_offset %= rom_banks_n;
-    addr %= rom_bank_size;
-
-    return rom_.read(0x4000 * bank_offset + addr);
+void Mbc1::update_banks() {
+    // The low bank bits are never 0, so the upper bits only show up at 0x0000 in RAM banking mode
+    map_banks(banking_mode_ == ram_mode ? mRomBankHi << 5 : 0, ((mRomBankHi << 5) | mRomBankLo) & 0x7F);
 }
 
 void Mbc1::write_ram(uint16_t addr, uint8_t val) {
@@ -48,3 +44,16 @@ uint8_t Mbc1::read_ram(uint16_t addr) {
         addr -= 0xA000;
     return ram_.read(bank * ram_bank_size + addr);
 }
+
+void Mbc1::save_state(gb::State_writer &out) const {
+    Mbc::save_state(out);
+    out.write(mRomBankLo);
+    out.write(mRomBankHi);
+}
+
+void Mbc1::load_state(gb::State_reader &in) {
+    Mbc::load_state(in);
+    in.read(mRomBankLo);
+    in.read(mRomBankHi);
+    update_banks();
+}
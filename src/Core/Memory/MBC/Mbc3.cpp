@@ -19,6 +19,7 @@ void Mbc3::write(uint16_t addr, uint8_t val) {
     }
     else if ( addr >= 0x2000 && addr <= 0x3FFF ) {
         mbc3_rom_bank = ((val & 0x7F) == 0) ? 1 : (val & 0x7F);
+        map_banks(0, mbc3_rom_bank);
     }
     else if ( addr >= 0x4000 && addr <= 0x5FFF ) {
         mbc3_ram_rtc_select = (val & 0xF) % 0xD;
@@ -31,12 +32,6 @@ void Mbc3::write(uint16_t addr, uint8_t val) {
     }
 }
 
-uint8_t Mbc3::read(uint16_t addr) {
-    unsigned int bank = addr < 0x4000 ? 0 : mbc3_rom_bank;
-    bank %= rom_banks_n;
-    return rom_.read(bank * rom_bank_size + (addr % 0x4000));
-}
-
 void Mbc3::write_ram(uint16_t addr, uint8_t val) {
     if ( ram_.is_enabled() ) {
         if ( mbc3_ram_rtc_select < 4 && has_ram_ )
@@ -86,3 +81,16 @@ uint8_t Mbc3::read_ram(uint16_t addr) {
     }
     return 0xFF;
 }
+
+void Mbc3::save_state(gb::State_writer &out) const {
+    Mbc::save_state(out);
+    out.write(mbc3_ram_rtc_select);
+    out.write(mbc3_rom_bank);
+}
+
+void Mbc3::load_state(gb::State_reader &in) {
+    Mbc::load_state(in);
+    in.read(mbc3_ram_rtc_select);
+    in.read(mbc3_rom_bank);
+    map_banks(0, mbc3_rom_bank);
+}
@@ -23,16 +23,21 @@ void Mbc5::write(uint16_t addr, uint8_t val) {
         mbc5_rom_hi = val & 1;
     if ( addr >= 0x4000 && addr <= 0x5FFF )
         mbc5_ram_bank = val & 0xF;
+    if ( addr >= 0x2000 && addr <= 0x3FFF )
+        map_banks(0, (mbc5_rom_lo | ((unsigned int) (mbc5_rom_hi) << 8)) & 0x1FF);
 }
 
-uint8_t Mbc5::read(uint16_t addr) {
-    unsigned int bank = 0;
-    if ( addr >= 0x4000 ) {
-        bank = mbc5_rom_lo;
-        bank |= ( (unsigned int) (mbc5_rom_hi) << 8);
-        bank &= 0x1FF;
-    }
-    bank %= rom_banks_n;
-    addr %= rom_bank_size;
-    return rom_.read(bank * rom_bank_size + addr);
+void Mbc5::save_state(gb::State_writer &out) const {
+    Mbc::save_state(out);
+    out.write(mbc5_rom_lo);
+    out.write(mbc5_rom_hi);
+    out.write(mbc5_ram_bank);
+}
+
+void Mbc5::load_state(gb::State_reader &in) {
+    Mbc::load_state(in);
+    in.read(mbc5_rom_lo);
+    in.read(mbc5_rom_hi);
+    in.read(mbc5_ram_bank);
+    map_banks(0, (mbc5_rom_lo | ((unsigned int) (mbc5_rom_hi) << 8)) & 0x1FF);
 }
@@ -4,10 +4,6 @@
 
 #include <Core/Memory/MBC/None.h>
 
-uint8_t gb::memory::mbc::None::read(uint16_t addr) {
-    return this->rom_.read(addr);
-}
-
 uint8_t gb::memory::mbc::None::read_ram(uint16_t) {
     return 0xFF;
 }
\ No newline at end of file
@@ -17,23 +17,8 @@ namespace {
     using gb::memory::io_boundaries;
     using gb::memory::io_sizes;
 
-    typedef gb::util::Mem_range<boundaries, memory_areas_size> Mem_span;
     typedef gb::util::Mem_range<io_boundaries, io_sizes> IO_span;
 
-    constexpr std::initializer_list<Mem_span> memory_map = {
-            {boundaries::bank0_start, memory_areas_size::rom},
-            {boundaries::vram_start, memory_areas_size::vram},
-            {boundaries::extram_start, memory_areas_size::extram},
-            {boundaries::wram_bank0_start, memory_areas_size::wram_bank0},
-            {boundaries::wram_bank1_start, memory_areas_size::wram_bank1},
-            {boundaries::echo_start,memory_areas_size::echo},
-            {boundaries::oam_start, memory_areas_size::oam},
-            {boundaries::prohibited_start, memory_areas_size::prohibited},
-            {boundaries::io_start, memory_areas_size::io},
-            {boundaries::hram_start, memory_areas_size::hram},
-            {boundaries::int_enable_start, memory_areas_size::int_enable}
-    };
-
     constexpr std::initializer_list<IO_span> io_ports_map = {
             {io_boundaries::io_head_start, io_sizes::io_head},
             {io_boundaries::apu_io_start, io_sizes::apu_io},
@@ -42,98 +27,200 @@ namespace {
     };
 }
 
-gb::memory::Memory::Memory(gb::Gameboy &gb, std::shared_ptr<cpu::Interrupts> interrupts, std::unique_ptr<mbc::Mbc> controller)
+gb::memory::Memory::Memory(gb::Gameboy &gb, std::shared_ptr<cpu::Interrupts> interrupts, std::unique_ptr<mbc::Cartridge> controller)
     : gb_(gb), controller_(std::move(controller)), interrupts_(std::move(interrupts)), hram_(0x7F), io_ports_(0x80),
       wram_(0x1000 << (gb.is_cgb_ ? 3 : 1)),
       dma_controller_(*this),
-      booting_(true) {
+      booting_(true),
+      mapping_generation_(0),
+      code_pages_(wram_.size() / 0x100 + 1, false) {
     std::ifstream b("DMG_ROM.bin", std::ios::binary | std::ios::in);
     b.read((char *) bootrom_.data(), 256);
     b.close();
+
+    map_rom();
+    map_vram();
+    map_wram();
 }
 
-uint8_t gb::memory::Memory::read(uint16_t addr) {
-    auto memory_area = std::find_if(memory_map.begin(), memory_map.end(), [addr](Mem_span s) {
-        return ((addr - s.start_) < s.size_);
-    });
+void gb::memory::Memory::map_rom() {
+    const uint8_t *bank0 = controller_->rom_bank_data(boundaries::bank0_start);
+    const uint8_t *bank1 = controller_->rom_bank_data(boundaries::bank0_start + mbc::rom_bank_size);
+    for ( unsigned int page = 0; page < 0x40; page++ ) {
+        read_pages_[page] = bank0 + (page << 8);
+        read_pages_[page + 0x40] = bank1 + (page << 8);
+    }
+    mapping_generation_++;
+}
 
-    // Not checking for std::find_if return value, because the GB's address space spans the whole range
-    // of values representable on 16 bits, so addr will never be greater than 0xFFFF.
-
-    switch (memory_area->start_) {
-        case boundaries::bank0_start:
-            return controller_->read(addr);
-        case boundaries::vram_start:
-            return gb_.gpu_->read_vram(addr - boundaries::vram_start);
-        case boundaries::extram_start:
-            return controller_->read_ram(addr - boundaries::extram_start);
-        case boundaries::wram_bank0_start:
-            return wram_.read(addr - boundaries::wram_bank0_start);
-        case boundaries::wram_bank1_start:
-            return wram_.read_bank_1(addr - boundaries::wram_bank1_start);
-        case boundaries::echo_start:
-            return read(addr - 0x2000);
-        case boundaries::oam_start:
-            return dma_controller_.is_running() ? 0xFF : gb_.gpu_->read_oam(addr - boundaries::oam_start);
-        case boundaries::prohibited_start:
-            break;
-        case boundaries::io_start:
-            return read_io_port(addr);
-        case boundaries::hram_start:
-            return hram_[addr - boundaries::hram_start];
-        case boundaries::int_enable_start:
-            return interrupts_->ie_flag();
-        default:
-            return 0xFF;
+void gb::memory::Memory::map_vram() {
+    // VRAM writes keep going through the Ppu, which blocks them during pixel transfer and updates its tile cache
+    const uint8_t *vram = gb_.gpu_->vram_bank_data();
+    for ( unsigned int page = 0; page < (memory_areas_size::vram >> 8); page++ )
+        read_pages_[(boundaries::vram_start >> 8) + page] = vram + (page << 8);
+}
+
+void gb::memory::Memory::map_wram() {
+    uint8_t *bank0 = wram_.data();
+    uint8_t *bank1 = wram_.data() + wram_.get_bank() * memory_areas_size::wram_bank0;
+    unsigned int bank1_page = wram_.get_bank() * (memory_areas_size::wram_bank0 >> 8);
+    for ( unsigned int page = 0; page < 0x10; page++ ) {
+        read_pages_[0xC0 + page] = write_pages_[0xC0 + page] = bank0 + (page << 8);
+        read_pages_[0xD0 + page] = write_pages_[0xD0 + page] = bank1 + (page << 8);
+        // Echo RAM mirrors 0xC000-0xDDFF
+        read_pages_[0xE0 + page] = write_pages_[0xE0 + page] = bank0 + (page << 8);
+        if ( 0xF0 + page < (boundaries::oam_start >> 8) )
+            read_pages_[0xF0 + page] = write_pages_[0xF0 + page] = bank1 + (page << 8);
+
+        if ( code_pages_[page] )
+            write_pages_[0xC0 + page] = write_pages_[0xE0 + page] = nullptr;
+        if ( code_pages_[bank1_page + page] )
+            write_pages_[0xD0 + page] = write_pages_[0xF0 + page] = nullptr;
     }
-    return 0xFF;
+    mapping_generation_++;
 }
 
-void gb::memory::Memory::write(uint16_t addr, uint8_t val) {
-    auto memory_area = std::find_if(memory_map.begin(), memory_map.end(), [addr](Mem_span s) {
-        return ((addr - s.start_) < s.size_);
-    });
+int gb::memory::Memory::code_bank(uint16_t addr) const {
+    if ( addr < boundaries::vram_start )
+        return static_cast<int>(controller_->rom_bank(addr));
+    if ( addr >= boundaries::wram_bank0_start && addr < boundaries::wram_bank1_start )
+        return 0;
+    if ( addr >= boundaries::wram_bank1_start && addr < boundaries::echo_start )
+        return wram_.get_bank();
+    if ( addr >= boundaries::hram_start && addr < boundaries::int_enable_start )
+        return 0;
+    return -1;
+}
 
-    switch (memory_area->start_) {
-        case boundaries::bank0_start:
-            controller_->write(addr, val);
-            break;
-        case boundaries::vram_start:
-            gb_.gpu_->write_vram(addr - boundaries::vram_start, val);
-            break;
-        case boundaries::extram_start:
-            controller_->write_ram(addr - boundaries::extram_start, val);
-            break;
-        case boundaries::wram_bank0_start:
-            wram_.write(addr - boundaries::wram_bank0_start, val);
-            break;
-        case boundaries::wram_bank1_start:
-            wram_.write_bank_1(addr - boundaries::wram_bank1_start, val);
-            break;
-        case boundaries::echo_start:
-            write(addr - 0x2000, val);
-            break;
-        case boundaries::oam_start:
-            if ( !dma_controller_.is_running() ) {
-               gb_.gpu_->write_oam(addr - boundaries::oam_start, val);
-            }
-            break;
-        case boundaries::prohibited_start:
-            break;
-        case boundaries::io_start:
-            write_io_port(addr, val);
-            break;
-        case boundaries::hram_start:
-            hram_[addr - boundaries::hram_start] = val;
-            break;
-        case boundaries::int_enable_start:
-            interrupts_->set_ie(val);
-            break;
+int gb::memory::Memory::code_page(uint16_t addr) const {
+    if ( addr >= boundaries::hram_start && addr < boundaries::int_enable_start )
+        return static_cast<int>(code_pages_.size()) - 1;
+    if ( addr >= boundaries::echo_start && addr < boundaries::oam_start )
+        addr -= 0x2000;
+    if ( addr >= boundaries::wram_bank1_start && addr < boundaries::echo_start )
+        return (wram_.get_bank() * memory_areas_size::wram_bank0 + (addr - boundaries::wram_bank1_start)) >> 8;
+    if ( addr >= boundaries::wram_bank0_start && addr < boundaries::wram_bank1_start )
+        return (addr - boundaries::wram_bank0_start) >> 8;
+    return -1;
+}
+
+int gb::memory::Memory::watch_code(uint16_t addr) {
+    int page = code_page(addr);
+    if ( page >= 0 && !code_pages_[page] ) {
+        code_pages_[page] = true;
+        map_wram();
+    }
+    return page;
+}
+
+void gb::memory::Memory::code_written(uint16_t addr) {
+    int page = code_page(addr);
+    if ( page >= 0 && code_pages_[page] && !gb_.cpu_->invalidate_code(page, addr) ) {
+        code_pages_[page] = false;
+        map_wram();
+    }
+}
+
+uint8_t gb::memory::Memory::read_slow(uint16_t addr) {
+    if ( addr == boundaries::int_enable_start )
+        return interrupts_->ie_flag();
+    if ( addr >= boundaries::hram_start )
+        return hram_[addr - boundaries::hram_start];
+    if ( addr >= boundaries::io_start )
+        return read_io_port(addr);
+    if ( addr >= boundaries::prohibited_start )
+        return 0xFF;
+    if ( addr >= boundaries::oam_start )
+        return dma_controller_.is_running() ? 0xFF : gb_.gpu_->read_oam(addr - boundaries::oam_start);
+    if ( addr >= boundaries::echo_start )
+        return read_slow(addr - 0x2000);
+    if ( addr >= boundaries::wram_bank1_start )
+        return wram_.read_bank_1(addr - boundaries::wram_bank1_start);
+    if ( addr >= boundaries::wram_bank0_start )
+        return wram_.read(addr - boundaries::wram_bank0_start);
+    if ( addr >= boundaries::extram_start )
+        return controller_->read_ram(addr - boundaries::extram_start);
+    if ( addr >= boundaries::vram_start )
+        return gb_.gpu_->read_vram(addr - boundaries::vram_start);
+    return controller_->read(addr);
+}
+
+void gb::memory::Memory::write_slow(uint16_t addr, uint8_t val) {
+    if ( addr == boundaries::int_enable_start ) {
+        interrupts_->set_ie(val);
+    } else if ( addr >= boundaries::hram_start ) {
+        hram_[addr - boundaries::hram_start] = val;
+        code_written(addr);
+    } else if ( addr >= boundaries::io_start ) {
+        write_io_port(addr, val);
+    } else if ( addr >= boundaries::prohibited_start ) {
+        return;
+    } else if ( addr >= boundaries::oam_start ) {
+        if ( !dma_controller_.is_running() ) {
+            // The Ppu may not have scanned OAM for the current line yet
+            gb_.gpu_->sync();
+            gb_.gpu_->write_oam(addr - boundaries::oam_start, val);
+        }
+    } else if ( addr >= boundaries::echo_start ) {
+        write_slow(addr - 0x2000, val);
+    } else if ( addr >= boundaries::wram_bank1_start ) {
+        wram_.write_bank_1(addr - boundaries::wram_bank1_start, val);
+        code_written(addr);
+    } else if ( addr >= boundaries::wram_bank0_start ) {
+        wram_.write(addr - boundaries::wram_bank0_start, val);
+        code_written(addr);
+    } else if ( addr >= boundaries::extram_start ) {
+        controller_->write_ram(addr - boundaries::extram_start, val);
+    } else if ( addr >= boundaries::vram_start ) {
+        gb_.gpu_->write_vram(addr - boundaries::vram_start, val);
+    } else {
+        // Most of these writes only toggle external RAM, the page table is rebuilt when a bank actually moves
+        const uint8_t *bank0 = controller_->rom_bank_data(boundaries::bank0_start);
+        const uint8_t *bank1 = controller_->rom_bank_data(boundaries::bank0_start + mbc::rom_bank_size);
+        controller_->write(addr, val);
+        if ( bank0 != controller_->rom_bank_data(boundaries::bank0_start)
+             || bank1 != controller_->rom_bank_data(boundaries::bank0_start + mbc::rom_bank_size) )
+            map_rom();
     }
 }
 
-void gb::memory::Memory::step_dma(unsigned int cycles) {
-    dma_controller_.step(cycles);
+void gb::memory::Memory::step_dma() {
+    // The transfer used to run before the Ppu within each slice, OAM writes must not be seen by dots already drawn
+    gb_.gpu_->sync(gb_.scheduler_.slice_start());
+    dma_controller_.step(gb_.scheduler_.now() - gb_.scheduler_.slice_start());
+    if ( !dma_controller_.is_completed() )
+        gb_.scheduler_.schedule(Scheduler::dma, gb_.scheduler_.now() + 1);
+}
+
+void gb::memory::Memory::save_state(State_writer &out) const {
+    dma_controller_.save_state(out);
+    controller_->save_state(out);
+    hram_.save_state(out);
+    io_ports_.save_state(out);
+    wram_.save_state(out);
+    out.write(booting_);
+}
+
+void gb::memory::Memory::load_state(State_reader &in) {
+    dma_controller_.load_state(in);
+    controller_->load_state(in);
+    hram_.load_state(in);
+    io_ports_.load_state(in);
+    wram_.load_state(in);
+    in.read(booting_);
+
+    // The Cpu dropped the blocks it had cached from RAM, nothing needs trapping until it decodes new ones
+    std::fill(code_pages_.begin(), code_pages_.end(), false);
+    map_rom();
+    map_vram();
+    map_wram();
+}
+
+// No link partner is ever connected: the byte shifted in is all ones
+void gb::memory::Memory::serial_event() {
+    io_ports_[io_ports::serial_data & 0xFF] = 0xFF;
+    io_ports_[io_ports::serial_control & 0xFF] &= 0x7F;
+    interrupts_->request(cpu::Interrupts::serial);
 }
 
 uint8_t gb::memory::Memory::read_io_port(uint16_t port_addr) {
@@ -188,7 +275,18 @@ void gb::memory::Memory::write_io_port(uint16_t port_addr, uint8_t val) {
         case io_boundaries::io_tail_start:
             switch (port_addr) {
                 case io_ports::serial_data:
-                    printf("%x ", val);
+                    if ( gb_.serial_sink_ )
+                        gb_.serial_sink_(val);
+                    io_ports_[port_addr - boundaries::io_start] = val;
+                    break;
+                case io_ports::serial_control:
+                    io_ports_[port_addr - boundaries::io_start] = val;
+                    // Transfers on the internal clock take 8 bits at 8192Hz, or 262144Hz with the CGB fast clock
+                    if ( (val & 0x81) == 0x81 )
+                        gb_.scheduler_.schedule(Scheduler::serial,
+                                                gb_.scheduler_.now() + (gb_.is_cgb_ && (val & 2) ? 128 : 4096));
+                    else
+                        gb_.scheduler_.cancel(Scheduler::serial);
                     break;
                 case io_ports::joypad_reg:
                     gb_.joypad_->select_key_group(val);
@@ -215,6 +313,7 @@ void gb::memory::Memory::write_io_port(uint16_t port_addr, uint8_t val) {
                 case io_ports::wram_bank_select:
                     if ( gb_.is_cgb_ ) {
                         wram_.switch_bank((val & 7) == 0 ? 1 : (val & 7));
+                        map_wram();
                     }
                     break;
                 case io_ports::bootrom_enable:
@@ -236,6 +335,7 @@ void gb::memory::Memory::write_io_port(uint16_t port_addr, uint8_t val) {
                     break;
                 case io_ports::dma_transfer:
                     dma_controller_.trigger(val);
+                    gb_.scheduler_.schedule(Scheduler::dma, gb_.scheduler_.now() + 1);
                     break;
                 default:
                     gb_.gpu_->send(port_addr, val);
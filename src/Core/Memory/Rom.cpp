@@ -0,0 +1,131 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#include "Core/Memory/Rom.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define OHBOI_ROM_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    uint64_t hash_contents(const uint8_t *data, size_t size) {
+        // 64 bit FNV-1a, one word at a time
+        constexpr uint64_t prime = 0x100000001B3;
+        uint64_t h = 0xCBF29CE484222325;
+        size_t i = 0;
+        for ( ; i + 8 <= size; i += 8 ) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            h = (h ^ word) * prime;
+        }
+        for ( ; i < size; i++ )
+            h = (h ^ data[i]) * prime;
+        return h;
+    }
+
+    /* Images currently in use are shared by contents: Roms of files with the same bytes, wherever they are, point at the
+     * same image. Telling whether a file's contents are already loaded without reading the whole of it goes through a
+     * second index, by canonical path, size read from the file, and the file's size, modification time and cartridge
+     * header as they were when it was mapped: a file rewritten under the same name misses and gets mapped and hashed
+     * again, unless the rewrite kept its size, header and global checksum and happened within the resolution of the
+     * timestamp. Entries of both expire with the last Rom using them. */
+    constexpr std::streamoff header_start = 0x100;
+    using Header = std::array<char, 0x50>;
+    using File_key = std::tuple<std::string, unsigned int, uintmax_t, std::filesystem::file_time_type::rep, Header>;
+    using Contents_key = std::pair<uint64_t, unsigned int>;
+    std::mutex cache_mutex;
+    std::map<File_key, std::weak_ptr<const gb::memory::Rom_image>> by_file;
+    std::map<Contents_key, std::weak_ptr<const gb::memory::Rom_image>> by_contents;
+}
+
+gb::memory::Rom_image::Rom_image(const std::filesystem::path &rom_path, unsigned int size)
+        : data_(nullptr), size_(size), hash_(0), mapping_(nullptr), mapping_size_(0) {
+#ifdef OHBOI_ROM_MMAP
+    int fd = open(rom_path.c_str(), O_RDONLY);
+    if ( fd >= 0 ) {
+        struct stat st {};
+        // A file shorter than its header claims can't be mapped whole, reads past its end would fault
+        if ( size > 0 && fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(size) ) {
+            void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if ( mapping != MAP_FAILED ) {
+                mapping_ = mapping;
+                mapping_size_ = size;
+                data_ = static_cast<const uint8_t *>(mapping);
+            }
+        }
+        close(fd);
+    }
+#endif
+    if ( data_ == nullptr ) {
+        // Missing banks read as open bus
+        copy_.assign(size, 0xFF);
+        std::ifstream file(rom_path, std::ios::in | std::ios::binary);
+        file.read(reinterpret_cast<char *>(copy_.data()), size);
+        data_ = copy_.data();
+    }
+    hash_ = hash_contents(data_, size_);
+}
+
+gb::memory::Rom_image::~Rom_image() {
+#ifdef OHBOI_ROM_MMAP
+    if ( mapping_ != nullptr )
+        munmap(mapping_, mapping_size_);
+#endif
+}
+
+gb::memory::Rom::Rom(std::filesystem::path &rom_path, unsigned int size) {
+    std::error_code ec;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(rom_path, ec);
+    std::string key_path = ec ? rom_path.string() : canonical.string();
+
+    // Looked up before touching the contents, so that a hit doesn't map or hash the file again
+    uintmax_t file_size = std::filesystem::file_size(rom_path, ec);
+    bool cacheable = !ec;
+    auto modified = std::filesystem::last_write_time(rom_path, ec);
+    cacheable = cacheable && !ec;
+    Header header{};
+    std::ifstream file(rom_path, std::ios::in | std::ios::binary);
+    file.seekg(header_start);
+    file.read(header.data(), header.size());
+    File_key key {key_path, size, file_size, modified.time_since_epoch().count(), header};
+
+    if ( cacheable ) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto entry = by_file.find(key);
+        if ( entry != by_file.end() )
+            image_ = entry->second.lock();
+    }
+    if ( image_ ) {
+        data_ = image_->data();
+        return;
+    }
+
+    auto image = std::make_shared<const Rom_image>(rom_path, size);
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    // Same contents as an image already in use, loaded from another file or by another Rom in the meantime
+    auto &shared = by_contents[{image->hash(), size}];
+    image_ = shared.lock();
+    if ( !image_ || std::memcmp(image_->data(), image->data(), size) != 0 ) {
+        image_ = std::move(image);
+        shared = image_;
+    }
+    if ( cacheable )
+        by_file[key] = image_;
+    std::erase_if(by_file, [](const auto &e) { return e.second.expired(); });
+    std::erase_if(by_contents, [](const auto &e) { return e.second.expired(); });
+    data_ = image_->data();
+}
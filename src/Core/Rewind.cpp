@@ -0,0 +1,210 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#include "Core/Rewind.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "Core/Gameboy.h"
+
+namespace {
+    /* Run-length encoding of zero bytes: a sequence of (zero run, literal run) pairs, both lengths as LEB128 varints,
+     * each followed by the literal bytes. Runs of zeroes shorter than a word are left in the literals. */
+    void put_varint(std::vector<uint8_t> &out, size_t val) {
+        while ( val >= 0x80 ) {
+            out.push_back(static_cast<uint8_t>(val | 0x80));
+            val >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(val));
+    }
+
+    bool get_varint(const uint8_t *&in, const uint8_t *end, size_t &val) {
+        val = 0;
+        for ( int shift = 0; in < end && shift < 64; shift += 7 ) {
+            uint8_t b = *in++;
+            val |= static_cast<size_t>(b & 0x7F) << shift;
+            if ( !(b & 0x80) )
+                return true;
+        }
+        return false;
+    }
+
+    uint64_t load_word(const uint8_t *p) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        return word;
+    }
+
+    bool has_zero_byte(uint64_t word) {
+        return ((word - 0x0101010101010101) & ~word & 0x8080808080808080) != 0;
+    }
+
+    void compress(const std::vector<uint8_t> &in, std::vector<uint8_t> &out) {
+        const size_t n = in.size();
+        const uint8_t *data = in.data();
+        out.clear();
+        put_varint(out, n);
+        size_t i = 0;
+        while ( i < n ) {
+            size_t literal = i;
+            while ( literal + 8 <= n && load_word(data + literal) == 0 )
+                literal += 8;
+            while ( literal < n && data[literal] == 0 )
+                literal++;
+
+            // Literals go on up to the next word of zeroes, which can't start inside a word with no zero bytes
+            size_t end = literal;
+            while ( end < n ) {
+                if ( end + 8 <= n ) {
+                    uint64_t word = load_word(data + end);
+                    if ( word == 0 )
+                        break;
+                    if ( !has_zero_byte(word) ) {
+                        end += 8;
+                        continue;
+                    }
+                }
+                end++;
+            }
+
+            put_varint(out, literal - i);
+            put_varint(out, end - literal);
+            out.insert(out.end(), data + literal, data + end);
+            i = end;
+        }
+    }
+
+    bool decompress(const std::vector<uint8_t> &in, std::vector<uint8_t> &out) {
+        const uint8_t *p = in.data();
+        const uint8_t *end = p + in.size();
+        size_t n;
+        if ( !get_varint(p, end, n) )
+            return false;
+        out.resize(n);
+        size_t i = 0;
+        while ( i < n ) {
+            size_t zeros, literal;
+            if ( !get_varint(p, end, zeros) || !get_varint(p, end, literal) || zeros > n - i
+                 || literal > n - i - zeros || literal > static_cast<size_t>(end - p) )
+                return false;
+            std::memset(out.data() + i, 0, zeros);
+            i += zeros;
+            std::memcpy(out.data() + i, p, literal);
+            p += literal;
+            i += literal;
+        }
+        return true;
+    }
+
+    // out = a ^ b over the length of a, b counting as zeroes past its end. Save states vary a little in length with
+    // the number of sprites and pixels queued in the Ppu.
+    void xor_with(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b, std::vector<uint8_t> &out) {
+        out.resize(a.size());
+        size_t n = std::min(a.size(), b.size());
+        size_t i = 0;
+        for ( ; i + 8 <= n; i += 8 ) {
+            uint64_t x, y;
+            std::memcpy(&x, a.data() + i, 8);
+            std::memcpy(&y, b.data() + i, 8);
+            x ^= y;
+            std::memcpy(out.data() + i, &x, 8);
+        }
+        for ( ; i < n; i++ )
+            out[i] = a[i] ^ b[i];
+        std::memcpy(out.data() + n, a.data() + n, a.size() - n);
+    }
+}
+
+gb::Rewind_buffer::Rewind_buffer(size_t budget_bytes, unsigned int keyframe_interval)
+        : budget_(budget_bytes), keyframe_interval_(std::max(keyframe_interval, 1u)), memory_used_(0),
+          since_keyframe_(0), stats_{} {}
+
+void gb::Rewind_buffer::capture(const Gameboy &gb) {
+    auto start = std::chrono::steady_clock::now();
+
+    gb.save_state(state_);
+    bool keyframe = keyframe_.empty() || since_keyframe_ + 1 >= keyframe_interval_;
+    if ( keyframe ) {
+        keyframe_.swap(state_);
+        compress(keyframe_, packed_);
+        since_keyframe_ = 0;
+    } else {
+        xor_with(state_, keyframe_, delta_);
+        compress(delta_, packed_);
+        since_keyframe_++;
+    }
+    push(keyframe);
+    evict();
+
+    auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    stats_.captures++;
+    stats_.total_ns += ns;
+    stats_.last_ns = ns;
+    stats_.last_size = entries_.back().data.size();
+}
+
+bool gb::Rewind_buffer::rewind(Gameboy &gb) {
+    if ( entries_.empty() )
+        return false;
+
+    Entry entry = std::move(entries_.back());
+    entries_.pop_back();
+    memory_used_ -= entry.data.size();
+
+    bool ok = decompress(entry.data, entry.keyframe ? state_ : delta_);
+    if ( ok && !entry.keyframe )
+        xor_with(delta_, keyframe_, state_);
+    ok = ok && gb.load_state(state_);
+
+    if ( entry.keyframe ) {
+        // The entries left over are relative to the keyframe before this one
+        auto previous = std::find_if(entries_.rbegin(), entries_.rend(), [](const Entry &e) { return e.keyframe; });
+        keyframe_.clear();
+        since_keyframe_ = static_cast<unsigned int>(previous - entries_.rbegin());
+        if ( previous != entries_.rend() && !decompress(previous->data, keyframe_) )
+            keyframe_.clear();
+        if ( keyframe_.empty() )
+            clear();
+    } else {
+        since_keyframe_--;
+    }
+    return ok;
+}
+
+void gb::Rewind_buffer::clear() {
+    entries_.clear();
+    keyframe_.clear();
+    memory_used_ = 0;
+    since_keyframe_ = 0;
+}
+
+void gb::Rewind_buffer::set_budget(size_t budget_bytes) {
+    budget_ = budget_bytes;
+    evict();
+}
+
+double gb::Rewind_buffer::seconds() const {
+    return static_cast<double>(entries_.size()) / 59.73;
+}
+
+void gb::Rewind_buffer::push(bool keyframe) {
+    // Deltas are much smaller than their capacity after the first keyframe, don't keep the slack around
+    entries_.push_back({keyframe, std::vector<uint8_t>(packed_.begin(), packed_.end())});
+    memory_used_ += packed_.size();
+}
+
+// Drops whole keyframes with their deltas, oldest first, never the one the newest entries depend on
+void gb::Rewind_buffer::evict() {
+    while ( memory_used_ > budget_ && !entries_.empty() ) {
+        auto next = std::find_if(entries_.begin() + 1, entries_.end(), [](const Entry &e) { return e.keyframe; });
+        if ( next == entries_.end() )
+            break;
+        for ( auto it = entries_.begin(); it != next; ++it )
+            memory_used_ -= it->data.size();
+        entries_.erase(entries_.begin(), next);
+    }
+}
@@ -0,0 +1,47 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#include "Core/Run_ahead.h"
+
+#include <chrono>
+
+#include "Core/Gameboy.h"
+
+namespace {
+    uint64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - since).count());
+    }
+}
+
+gb::Run_ahead::Run_ahead(unsigned int frames) : frames_(frames), stats_{} {}
+
+void gb::Run_ahead::run_frame(Gameboy &gb) {
+    if ( gb.is_paused() )
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    gb.set_publish_frames(frames_ == 0);
+    gb.run_frame();
+    const auto &samples = gb.get_audio_output();
+    audio_.assign(samples.begin(), samples.end());
+    gb.set_audio_reproduced();
+    stats_.real_ns += elapsed_ns(start);
+    stats_.frames++;
+
+    if ( frames_ == 0 )
+        return;
+
+    start = std::chrono::steady_clock::now();
+    gb.save_state(state_);
+    for ( unsigned int i = 0; i < frames_; i++ ) {
+        gb.set_publish_frames(i == frames_ - 1);
+        gb.run_frame();
+    }
+    gb.load_state(state_);
+    gb.set_publish_frames(true);
+    // What the speculative frames played will be heard when they're run for real
+    gb.set_audio_reproduced();
+    stats_.ahead_ns += elapsed_ns(start);
+}
@@ -0,0 +1,83 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#include "Core/Scheduler.h"
+
+using gb::Scheduler;
+
+Scheduler::Scheduler() : heap_{}, size_(0), now_(0), slice_start_(0) {
+    index_.fill(-1);
+}
+
+Scheduler::Entry Scheduler::pop() {
+    Entry top = heap_[0];
+    remove_at(0);
+    return top;
+}
+
+void Scheduler::schedule(Event event, uint64_t time) {
+    int i = index_[event];
+    if ( i < 0 ) {
+        i = size_++;
+        place(i, {time, event});
+        sift_up(i);
+        return;
+    }
+
+    uint64_t old_time = heap_[i].time;
+    heap_[i].time = time;
+    if ( time < old_time )
+        sift_up(i);
+    else
+        sift_down(i);
+}
+
+void Scheduler::cancel(Event event) {
+    if ( index_[event] >= 0 )
+        remove_at(index_[event]);
+}
+
+void Scheduler::place(int i, const Entry &e) {
+    heap_[i] = e;
+    index_[e.event] = i;
+}
+
+void Scheduler::sift_up(int i) {
+    Entry e = heap_[i];
+    while ( i > 0 ) {
+        int parent = (i - 1) / 2;
+        if ( !before(e, heap_[parent]) )
+            break;
+        place(i, heap_[parent]);
+        i = parent;
+    }
+    place(i, e);
+}
+
+void Scheduler::sift_down(int i) {
+    Entry e = heap_[i];
+    while ( true ) {
+        int child = 2 * i + 1;
+        if ( child >= size_ )
+            break;
+        if ( child + 1 < size_ && before(heap_[child + 1], heap_[child]) )
+            child++;
+        if ( !before(heap_[child], e) )
+            break;
+        place(i, heap_[child]);
+        i = child;
+    }
+    place(i, e);
+}
+
+void Scheduler::remove_at(int i) {
+    index_[heap_[i].event] = -1;
+    if ( --size_ == i )
+        return;
+    place(i, heap_[size_]);
+    if ( i > 0 && before(heap_[i], heap_[(i - 1) / 2]) )
+        sift_up(i);
+    else
+        sift_down(i);
+}
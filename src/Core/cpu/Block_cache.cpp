@@ -0,0 +1,49 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#include <algorithm>
+
+#include "Core/Cpu/Block_cache.h"
+
+using gb::cpu::Block_cache;
+
+const Block_cache::Block *Block_cache::insert(uint32_t key, Block block, int ram_page) {
+    if ( ram_page >= 0 )
+        ram_pages_[ram_page].push_back(key);
+    block.id = next_id_++;
+    return &(blocks_[key] = std::move(block));
+}
+
+bool Block_cache::invalidate(int ram_page, uint8_t offset) {
+    auto page = ram_pages_.find(ram_page);
+    if ( page == ram_pages_.end() )
+        return false;
+
+    std::erase_if(page->second, [this, offset](uint32_t key) {
+        auto block = blocks_.find(key);
+        if ( block == blocks_.end() )
+            return true;
+        if ( offset < (block->second.start & 0xFF) || offset > (block->second.end & 0xFF) )
+            return false;
+        blocks_.erase(block);
+        return true;
+    });
+    if ( page->second.empty() ) {
+        ram_pages_.erase(page);
+        return false;
+    }
+    return true;
+}
+
+void Block_cache::clear() {
+    blocks_.clear();
+    ram_pages_.clear();
+}
+
+void Block_cache::clear_ram() {
+    for ( const auto &page : ram_pages_ )
+        for ( uint32_t key : page.second )
+            blocks_.erase(key);
+    ram_pages_.clear();
+}
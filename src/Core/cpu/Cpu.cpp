@@ -2,14 +2,39 @@
 // Created by antonio on 30/07/20.
 //
 
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
 #include "Core/Cpu/Cpu.h"
 #include "Core/Cpu/Registers.h"
 #include "Core/Gameboy.h"
 #include "Core/Cpu/Interrupts.h"
 #include "Core/Cpu/cpu_defs.h"
+#include "Logger/Logger.h"
 
 using gb::cpu::Cpu;
 
+// GCC and Clang can take the address of a label, which lets decode_n_xecute jump straight to the handler of an opcode
+// through a table of labels instead of going through the range check and jump table of the switch. Every other
+// compiler (or a build defining OHBOI_NO_COMPUTED_GOTO) gets the plain switch, built from the very same handlers.
+#if defined(__GNUC__) && !defined(OHBOI_NO_COMPUTED_GOTO)
+#define OHBOI_COMPUTED_GOTO
+#endif
+
+#ifdef OHBOI_COMPUTED_GOTO
+#define OPCODE(n) op_##n:
+#define NEXT return
+#define DISPATCH_ROW(hi) \
+        &&op_0x##hi##0, &&op_0x##hi##1, &&op_0x##hi##2, &&op_0x##hi##3, \
+        &&op_0x##hi##4, &&op_0x##hi##5, &&op_0x##hi##6, &&op_0x##hi##7, \
+        &&op_0x##hi##8, &&op_0x##hi##9, &&op_0x##hi##A, &&op_0x##hi##B, \
+        &&op_0x##hi##C, &&op_0x##hi##D, &&op_0x##hi##E, &&op_0x##hi##F
+#else
+#define OPCODE(n) case n:
+#define NEXT break
+#endif
+
 namespace {
     inline uint8_t set(int bit, uint8_t val) {
         bit = 1 << bit;
@@ -24,14 +49,6 @@ namespace {
     }
 }
 
-union gb::cpu::Instr_argument {
-    struct {
-        uint8_t lsb;
-        uint8_t msb;
-    };
-    uint16_t word;
-};
-
 Cpu::Cpu(Gameboy &gb, std::shared_ptr<Interrupts> interrupts, std::shared_ptr<Joypad> joypad)
         : gb_(gb),
           regs_(gb.is_cgb_),
@@ -43,6 +60,7 @@ Cpu::Cpu(Gameboy &gb, std::shared_ptr<Interrupts> interrupts, std::shared_ptr<Jo
           tma_(0),
           tac_(0),
           timer_counter_(1024),
+          timers_synced_(gb.scheduler_.now()),
           div_reg_(0),
           div_counter_(0),
           booting_(false),
@@ -53,14 +71,12 @@ Cpu::Cpu(Gameboy &gb, std::shared_ptr<Interrupts> interrupts, std::shared_ptr<Jo
           timer_overflow_(false),
           double_speed_(false),
           cycles_(0),
-          alu_functions_{
-                  &Cpu::add, &Cpu::adc, &Cpu::sub, &Cpu::sbc,
-                  &Cpu::and_l, &Cpu::xor_l, &Cpu::or_l, &Cpu::cp
-          },
-          rotate_instructions_{
-                  &Cpu::rlc, &Cpu::rrc, &Cpu::rl, &Cpu::rr,
-                  &Cpu::sla, &Cpu::sra, &Cpu::swap, &Cpu::srl
-          }
+          current_block_(nullptr),
+          block_pos_(0),
+          block_mapping_(0),
+          idle_loop_{},
+          idle_loop_stats_{},
+          jit_stats_{}
 {
     debug_ = false;
     //reset();
@@ -81,6 +97,9 @@ void Cpu::reset() {
     tac_ = 0;
     halted_ = false;
     halt_bug_triggered_ = false;
+    current_block_ = nullptr;
+    block_cache_.clear();
+    idle_loop_ = {};
 
     interrupts_->set_ime(false);
     interrupts_->set_if(0xE1);
@@ -88,21 +107,53 @@ void Cpu::reset() {
 
     div_counter_ = 0;
     timer_counter_ = 1024;
+    timers_synced_ = gb_.scheduler_.now();
     timer_overflow_ = false;
     double_speed_ = false;
+    schedule_timer_overflow();
 }
 
 void Cpu::step() {
+    check_idle_loop();
+    interpret();
+}
+
+void Cpu::step([[maybe_unused]] unsigned int max_cycles, [[maybe_unused]] uint64_t until) {
+    check_idle_loop();
+#ifdef OHBOI_JIT
+    if ( jit_ && run_native(max_cycles, until) )
+        return;
+#endif
+    interpret();
+}
+
+inline void Cpu::check_idle_loop() {
+    if ( current_block_ != nullptr && current_block_->polled_register != 0 && pc_ == current_block_->start
+         && block_mapping_ == gb_.mmu_->mapping_generation() )
+        skip_idle_loop();
+}
+
+inline void Cpu::interpret() {
+    begin_step();
+    cycles_ += halted_ ? 4 : fetch();
+    end_step();
+}
+
+inline void Cpu::begin_step() {
     if ( ei_last_instruction_ ) {
         ei_last_instruction_ = false;
         interrupts_->set_ime(true);
     }
     if ( timer_overflow_ ) {
         timer_overflow_ = false;
+        sync_timers();
         tima_ = tma_;
         interrupts_->request(Interrupts::timer);
+        schedule_timer_overflow();
     }
-    cycles_ += halted_ ? 4 : fetch();
+}
+
+inline void Cpu::end_step() {
     if ( halted_ )
         gb_.clock(4);
     update_buttons();
@@ -110,9 +161,28 @@ void Cpu::step() {
         halted_ = false;
     } else
         service_interrupts();
+
+    /* Still halted means nothing woke the Cpu up, and nothing will until one of the scheduled events runs: the steps
+     * in between would only move time forward 4 cycles at a time, so jump right before the one that reaches it. A
+     * pending timer overflow is raised at the beginning of the next step, which has to happen for real. */
+    if ( halted_ && !timer_overflow_ )
+        cycles_ += gb_.skip_idle(4, max_idle_skip);
 }
 
 unsigned int Cpu::fetch() {
+    if ( !halt_bug_triggered_ && !debug_ ) {
+        if ( const auto *cached = next_cached_instruction() ) {
+            // Same bus timing as the uncached path, one memory access per instruction byte
+            for ( unsigned int i = 0; i < cached->length; i++ )
+                gb_.clock(4);
+            // The instruction may overwrite its own block, don't touch it after executing
+            unsigned int cycles = cached->cycles;
+            pc_ += cached->length;
+            decode_n_xecute(cached->opcode, cached->arg);
+            return cycles;
+        }
+    }
+
     uint8_t opcode = read_memory(pc_);
     if ( halt_bug_triggered_ )
         halt_bug_triggered_ = false;
@@ -126,482 +196,823 @@ unsigned int Cpu::fetch() {
     if (opcodes[opcode].n_operands == 2 )
         arg.msb = read_memory(pc_++);
     if ( debug_ ) {
+        char line[32];
         switch ( opcodes[opcode].n_operands ) {
             case 0:
-                printf("%s", instr[opcode].c_str());
+                snprintf(line, sizeof(line), "%s", instr[opcode].c_str());
                 break;
             case 1:
-                printf(instr[opcode].c_str(), arg.lsb);
+                snprintf(line, sizeof(line), instr[opcode].c_str(), arg.lsb);
                 break;
-            case 2:
-                printf(instr[opcode].c_str(), arg.word);
+            default:
+                snprintf(line, sizeof(line), instr[opcode].c_str(), arg.word);
                 break;
         }
-        printf("\n");
+        Logger::info("Cpu", line);
     }
 
     decode_n_xecute(opcode, arg);
     return opcode != 0xCB ? opcodes[opcode].n_cycles : cb_instructions_cycles[arg.lsb];
 }
 
+inline bool Cpu::at_block_boundary() const {
+    return current_block_ == nullptr || block_mapping_ != gb_.mmu_->mapping_generation()
+           || block_pos_ >= current_block_->instructions.size() || current_block_->instructions[block_pos_].addr != pc_;
+}
+
+const gb::cpu::Block_cache::Block *Cpu::enter_block() {
+    block_pos_ = 0;
+    block_mapping_ = gb_.mmu_->mapping_generation();
+    int bank = gb_.mmu_->code_bank(pc_);
+    if ( bank < 0 )
+        return current_block_ = nullptr;
+    current_block_ = block_cache_.find(Block_cache::key(bank, pc_));
+    if ( current_block_ == nullptr ) {
+        current_block_ = decode_block(pc_);
+        // Decoding code in RAM remaps its page
+        block_mapping_ = gb_.mmu_->mapping_generation();
+    }
+    return current_block_;
+}
+
+const gb::cpu::Block_cache::Instruction *Cpu::next_cached_instruction() {
+    if ( at_block_boundary() && enter_block() == nullptr )
+        return nullptr;
+    return &current_block_->instructions[block_pos_++];
+}
+
+namespace {
+    bool ends_block(uint8_t opcode) {
+        switch ( opcode ) {
+            case 0x10: case 0x76:                                           // stop, halt
+            case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:          // jr
+            case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9: // jp
+            case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:          // call
+            case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9: // ret, reti
+            case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // rst
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+namespace {
+    // Instructions that only work on registers and flags, whatever the values involved
+    bool register_only(const gb::cpu::Block_cache::Instruction &instruction) {
+        uint8_t op = instruction.opcode;
+        if ( op >= 0x40 && op < 0x80 )                                      // ld r, r'
+            return (op & 7) != 6 && ((op >> 3) & 7) != 6;
+        if ( op >= 0x80 && op < 0xC0 )                                      // alu a, r
+            return (op & 7) != 6;
+        switch ( op ) {
+            case 0x00:                                                      // nop
+            case 0x01: case 0x11: case 0x21: case 0x31:                     // ld rr, nn
+            case 0x03: case 0x13: case 0x23: case 0x33:                     // inc rr
+            case 0x0B: case 0x1B: case 0x2B: case 0x3B:                     // dec rr
+            case 0x09: case 0x19: case 0x29: case 0x39:                     // add hl, rr
+            case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C: // inc r
+            case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D: // dec r
+            case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E: // ld r, n
+            case 0x07: case 0x0F: case 0x17: case 0x1F:                     // rlca, rrca, rla, rra
+            case 0x27: case 0x2F: case 0x37: case 0x3F:                     // daa, cpl, scf, ccf
+            case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // alu a, n
+                return true;
+            case 0xCB:
+                return (instruction.arg.lsb & 7) != 6;
+            default:
+                return false;
+        }
+    }
+
+    bool pollable(uint16_t addr) {
+        return addr == gb::graphics::Ppu::lcd_status || addr == gb::graphics::Ppu::ly
+               || addr == gb::memory::io_ports::div_reg || addr == gb::memory::io_ports::tima;
+    }
+
+    /* A block that jumps back to its own start and, besides reading one register whose value only changes with time,
+     * only touches registers: as long as the register reads the same, an iteration that leaves the Cpu as it found it
+     * will keep doing so */
+    uint16_t polled_register(const gb::cpu::Block_cache::Block &block) {
+        const auto &last = block.instructions.back();
+        uint16_t target;
+        switch ( last.opcode ) {
+            case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+                target = last.addr + 2 + static_cast<int8_t>(last.arg.lsb);
+                break;
+            case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:
+                target = last.arg.word;
+                break;
+            default:
+                return 0;
+        }
+        if ( target != block.start )
+            return 0;
+
+        uint16_t polled = 0;
+        for ( auto it = block.instructions.begin(); it != block.instructions.end() - 1; ++it ) {
+            uint16_t addr;
+            if ( it->opcode == 0xF0 )                                       // ld a, (0xFF00 + n)
+                addr = 0xFF00 | it->arg.lsb;
+            else if ( it->opcode == 0xFA )                                  // ld a, (nn)
+                addr = it->arg.word;
+            else if ( register_only(*it) )
+                continue;
+            else
+                return 0;
+            if ( !pollable(addr) || (polled != 0 && addr != polled) )
+                return 0;
+            polled = addr;
+        }
+        return polled;
+    }
+}
+
+const gb::cpu::Block_cache::Block *Cpu::decode_block(uint16_t pc) {
+    // Decoding peeks at memory without clocking the rest of the machine: only ROM, WRAM and HRAM are ever cached and
+    // reading them has no side effects
+    int bank = gb_.mmu_->code_bank(pc);
+    Block_cache::Block block{.id = 0, .start = pc, .end = pc, .cycles = 0, .instructions = {}, .polled_register = 0};
+    uint16_t addr = pc;
+    while ( true ) {
+        uint8_t opcode = gb_.mmu_->read(addr);
+        uint8_t length = opcodes[opcode].n_operands + 1;
+        uint16_t last = addr + length - 1;
+        if ( (last & 0xFF00) != (pc & 0xFF00) || last < addr || gb_.mmu_->code_bank(last) != bank )
+            break;
+
+        Block_cache::Instruction instruction{.addr = addr, .opcode = opcode, .length = length, .cycles = 0,
+                                             .run_length = 0, .arg = {.word = 0}};
+        if ( length >= 2 )
+            instruction.arg.lsb = gb_.mmu_->read(addr + 1);
+        if ( length == 3 )
+            instruction.arg.msb = gb_.mmu_->read(addr + 2);
+        instruction.cycles = opcode != 0xCB ? opcodes[opcode].n_cycles : cb_instructions_cycles[instruction.arg.lsb];
+
+        block.instructions.push_back(instruction);
+        block.cycles += instruction.cycles;
+        block.end = last;
+        addr = last + 1;
+        if ( ends_block(opcode) || addr == 0 )
+            break;
+    }
+    if ( block.instructions.empty() )
+        return nullptr;
+    block.polled_register = polled_register(block);
+#ifdef OHBOI_JIT
+    Jit::mark_runs(block);
+#endif
+    return block_cache_.insert(Block_cache::key(bank, pc), std::move(block), gb_.mmu_->watch_code(pc));
+}
+
+#ifdef OHBOI_JIT
+void Cpu::set_jit_enabled(bool enabled) {
+    if ( enabled && !jit_ )
+        jit_ = Jit::create();
+    else if ( !enabled )
+        jit_.reset();
+}
+
+/* Goes through the compiled run at pc in one go, if the interpreter would have gone through it without anything
+ * happening in between its instructions: no EI or TIMA reload taking effect, no interrupt to service or joypad
+ * interrupt to request, and no event coming due while the machine is clocked. The run only touches registers, so none
+ * of that can change halfway through it either. */
+bool Cpu::run_native(unsigned int max_cycles, uint64_t until) {
+    if ( ei_last_instruction_ || timer_overflow_ || halted_ || halt_bug_triggered_ || debug_ )
+        return false;
+    if ( at_block_boundary() && enter_block() == nullptr )
+        return false;
+    if ( current_block_->instructions[block_pos_].run_length < Jit::min_run )
+        return false;
+    if ( (interrupts_->ime() && interrupts_->interrupts_pending())
+         || (joypad_held() && !interrupts_->is_requested(Interrupts::jpad)) )
+        return false;
+
+    const Jit::Run *run = jit_->lookup(*current_block_, block_pos_);
+    if ( run == nullptr || run->cycles > max_cycles || !gb_.clock_without_events(run->clocks, until) )
+        return false;
+    regs_.flush_flags();
+    run->fn(&regs_, &sp_);
+    pc_ += run->bytes;
+    block_pos_ += run->instructions;
+    cycles_ += run->cycles;
+    jit_stats_.runs++;
+    jit_stats_.instructions += run->instructions;
+    return true;
+}
+#else
+void Cpu::set_jit_enabled(bool) {}
+#endif
+
+bool Cpu::invalidate_code(int ram_page, uint16_t addr) {
+    current_block_ = nullptr;
+    return block_cache_.invalidate(ram_page, addr & 0xFF);
+}
+
+void Cpu::save_state(State_writer &out) const {
+    for ( unsigned int r : {AF, BC, DE, HL} )
+        out.write(regs_.read_short(r));
+    out.write(pc_);
+    out.write(sp_);
+
+    out.write(tima_);
+    out.write(tma_);
+    out.write(static_cast<uint8_t>(tac_.to_ulong()));
+    out.write(timer_counter_);
+    out.write(timers_synced_);
+    out.write(div_reg_);
+    out.write(div_counter_);
+
+    out.write(booting_);
+    out.write(ei_last_instruction_);
+    out.write(halted_);
+    out.write(halt_bug_triggered_);
+    out.write(timer_overflow_);
+    out.write(double_speed_);
+    out.write(cycles_);
+    out.write(*interrupts_);
+}
+
+void Cpu::load_state(State_reader &in) {
+    for ( unsigned int r : {AF, BC, DE, HL} )
+        regs_.load_short(r, in.read<uint16_t>());
+    in.read(pc_);
+    in.read(sp_);
+
+    in.read(tima_);
+    in.read(tma_);
+    tac_ = in.read<uint8_t>();
+    in.read(timer_counter_);
+    in.read(timers_synced_);
+    in.read(div_reg_);
+    in.read(div_counter_);
+
+    in.read(booting_);
+    in.read(ei_last_instruction_);
+    in.read(halted_);
+    in.read(halt_bug_triggered_);
+    in.read(timer_overflow_);
+    in.read(double_speed_);
+    in.read(cycles_);
+    in.read(*interrupts_);
+
+    current_block_ = nullptr;
+    block_pos_ = 0;
+    idle_loop_ = {};
+    block_cache_.clear_ram();
+}
+
 void Cpu::decode_n_xecute(uint8_t opcode, Instr_argument arg) {
     uint8_t temp_b;
     uint16_t temp_w;
+#ifdef OHBOI_COMPUTED_GOTO
+    static const void *const dispatch_table[0x100] = {
+            DISPATCH_ROW(0), DISPATCH_ROW(1), DISPATCH_ROW(2), DISPATCH_ROW(3),
+            DISPATCH_ROW(4), DISPATCH_ROW(5), DISPATCH_ROW(6), DISPATCH_ROW(7),
+            DISPATCH_ROW(8), DISPATCH_ROW(9), DISPATCH_ROW(A), DISPATCH_ROW(B),
+            DISPATCH_ROW(C), DISPATCH_ROW(D), DISPATCH_ROW(E), DISPATCH_ROW(F)
+    };
+    goto *dispatch_table[opcode];
+#else
     switch ( opcode ) {
-        case 0x00:
-            break;
-        case 0x01:
+#endif
+        OPCODE(0x00)
+            NEXT;
+        OPCODE(0x01)
             regs_.load_short(BC, arg.word);
-            break;
-        case 0x02:
+            NEXT;
+        OPCODE(0x02)
             write_memory(regs_.read_short(BC), regs_.read_byte(REG_A));
-            break;
-        case 0x03:
+            NEXT;
+        OPCODE(0x03)
             inc16(BC);
-            break;
-        case 0x04:
+            NEXT;
+        OPCODE(0x04)
             inc8(REG_B);
-            break;
-        case 0x05:
+            NEXT;
+        OPCODE(0x05)
             dec8(REG_B);
-            break;
-        case 0x06:
+            NEXT;
+        OPCODE(0x06)
             regs_.load_byte(REG_B, arg.lsb);
-            break;
-        case 0x07:
+            NEXT;
+        OPCODE(0x07)
             rlca();
-            break;
-        case 0x08:
+            NEXT;
+        OPCODE(0x08)
             write_memory_short(arg.word, sp_);
-            break;
-        case 0x09:
+            NEXT;
+        OPCODE(0x09)
             add_hl(regs_.read_short(BC));
-            break;
-        case 0x0A:
+            NEXT;
+        OPCODE(0x0A)
             regs_.load_byte(REG_A, read_memory(regs_.read_short(BC)));
-            break;
-        case 0x0B:
+            NEXT;
+        OPCODE(0x0B)
             dec16(BC);
-            break;
-        case 0x0C:
+            NEXT;
+        OPCODE(0x0C)
             inc8(REG_C);
-            break;
-        case 0x0D:
+            NEXT;
+        OPCODE(0x0D)
             dec8(REG_C);
-            break;
-        case 0x0E:
+            NEXT;
+        OPCODE(0x0E)
             regs_.load_byte(REG_C, arg.lsb);
-            break;
-        case 0x0F:
+            NEXT;
+        OPCODE(0x0F)
             rrca();
-            break;
-        case 0x10:
+            NEXT;
+        OPCODE(0x10)
             stop();
-            break;
-        case 0x11:
+            NEXT;
+        OPCODE(0x11)
             regs_.load_short(DE, arg.word);
-            break;
-        case 0x12:
+            NEXT;
+        OPCODE(0x12)
             write_memory(regs_.read_short(DE), regs_.read_byte(REG_A));
-            break;
-        case 0x13:
+            NEXT;
+        OPCODE(0x13)
             inc16(DE);
-            break;
-        case 0x14:
+            NEXT;
+        OPCODE(0x14)
             inc8(REG_D);
-            break;
-        case 0x15:
+            NEXT;
+        OPCODE(0x15)
             dec8(REG_D);
-            break;
-        case 0x16:
+            NEXT;
+        OPCODE(0x16)
             regs_.load_byte(REG_D, arg.lsb);
-            break;
-        case 0x17:
+            NEXT;
+        OPCODE(0x17)
             rla();
-            break;
-        case 0x18:
+            NEXT;
+        OPCODE(0x18)
             jr((int8_t) arg.lsb);
-            break;
-        case 0x19:
+            NEXT;
+        OPCODE(0x19)
             add_hl(regs_.read_short(DE));
-            break;
-        case 0x1A:
+            NEXT;
+        OPCODE(0x1A)
             regs_.load_byte(REG_A, read_memory(regs_.read_short(DE)));
-            break;
-        case 0x1B:
+            NEXT;
+        OPCODE(0x1B)
             dec16(DE);
-            break;
-        case 0x1C:
+            NEXT;
+        OPCODE(0x1C)
             inc8(REG_E);
-            break;
-        case 0x1D:
+            NEXT;
+        OPCODE(0x1D)
             dec8(REG_E);
-            break;
-        case 0x1E:
+            NEXT;
+        OPCODE(0x1E)
             regs_.load_byte(REG_E, arg.lsb);
-            break;
-        case 0x1F:
+            NEXT;
+        OPCODE(0x1F)
             rra();
-            break;
-        case 0x20:
+            NEXT;
+        OPCODE(0x20)
             if ( !( regs_.zero() ) )
                 jr((int8_t) arg.lsb);
-            break;
-        case 0x21:
+            NEXT;
+        OPCODE(0x21)
             regs_.load_short(HL, arg.word);
-            break;
-        case 0x22:
+            NEXT;
+        OPCODE(0x22)
             temp_w = regs_.read_short(HL);
             write_memory(temp_w, regs_.read_byte(REG_A));
             regs_.load_short(HL, temp_w + 1);
-            break;
-        case 0x23:
+            NEXT;
+        OPCODE(0x23)
             inc16(HL);
-            break;
-        case 0x24:
+            NEXT;
+        OPCODE(0x24)
             inc8(REG_H);
-            break;
-        case 0x25:
+            NEXT;
+        OPCODE(0x25)
             dec8(REG_H);
-            break;
-        case 0x26:
+            NEXT;
+        OPCODE(0x26)
             regs_.load_byte(REG_H, arg.lsb);
-            break;
-        case 0x27:
+            NEXT;
+        OPCODE(0x27)
             daa();
-            break;
-        case 0x28:
+            NEXT;
+        OPCODE(0x28)
             if ( regs_.zero() )
                 jr((int8_t) arg.lsb);
-            break;
-        case 0x29:
+            NEXT;
+        OPCODE(0x29)
             add_hl(regs_.read_short(HL));
-            break;
-        case 0x2A:
+            NEXT;
+        OPCODE(0x2A)
             temp_w = regs_.read_short(HL);
             regs_.load_byte(REG_A, read_memory(temp_w));
             regs_.load_short(HL, temp_w + 1);
-            break;
-        case 0x2B:
+            NEXT;
+        OPCODE(0x2B)
             dec16(HL);
-            break;
-        case 0x2C:
+            NEXT;
+        OPCODE(0x2C)
             inc8(REG_L);
-            break;
-        case 0x2D:
+            NEXT;
+        OPCODE(0x2D)
             dec8(REG_L);
-            break;
-        case 0x2E:
+            NEXT;
+        OPCODE(0x2E)
             regs_.load_byte(REG_L, arg.lsb);
-            break;
-        case 0x2F:
+            NEXT;
+        OPCODE(0x2F)
             cpl();
-            break;
-        case 0x30:
+            NEXT;
+        OPCODE(0x30)
             if ( !regs_.carry() )
                 jr((int8_t) arg.lsb);
-            break;
-        case 0x31:
+            NEXT;
+        OPCODE(0x31)
             sp_ = arg.word;
-            break;
-        case 0x32:
+            NEXT;
+        OPCODE(0x32)
             temp_w = regs_.read_short(HL);
             write_memory(temp_w, regs_.read_byte(REG_A));
             regs_.load_short(HL, temp_w - 1);
-            break;
-        case 0x33:
+            NEXT;
+        OPCODE(0x33)
             inc16(SP);
-            break;
-        case 0x34:
-            temp_b = read_memory(regs_.read_short(HL));
-            regs_.set_half_carry((temp_b & 0xF) == 0xF);
-            ++temp_b;
-            regs_.set_zero(temp_b == 0);
-            regs_.set_sub(false);
+            NEXT;
+        OPCODE(0x34)
+            temp_b = read_memory(regs_.read_short(HL)) + 1;
+            regs_.set_inc_flags(temp_b);
             write_memory(regs_.read_short(HL), temp_b);
-            break;
-        case 0x35:
-            temp_b = read_memory(regs_.read_short(HL));
-            regs_.set_half_carry(!(temp_b & 0xF));
-            --temp_b;
-            regs_.set_zero(temp_b == 0);
-            regs_.set_sub(true);
+            NEXT;
+        OPCODE(0x35)
+            temp_b = read_memory(regs_.read_short(HL)) - 1;
+            regs_.set_dec_flags(temp_b);
             write_memory(regs_.read_short(HL), temp_b);
-            break;
-        case 0x36:
+            NEXT;
+        OPCODE(0x36)
             write_memory(regs_.read_short(HL), arg.lsb);
-            break;
-        case 0x37:
+            NEXT;
+        OPCODE(0x37)
             scf();
-            break;
-        case 0x38:
+            NEXT;
+        OPCODE(0x38)
             if ( regs_.carry() )
                 jr((int8_t) arg.lsb);
-            break;
-        case 0x39:
+            NEXT;
+        OPCODE(0x39)
             add_hl(sp_);
-            break;
-        case 0x3A:
+            NEXT;
+        OPCODE(0x3A)
             temp_w = regs_.read_short(HL);
             regs_.load_byte(REG_A, read_memory(temp_w));
             regs_.load_short(HL, temp_w - 1);
-            break;
-        case 0x3B:
+            NEXT;
+        OPCODE(0x3B)
             dec16(SP);
-            break;
-        case 0x3C:
+            NEXT;
+        OPCODE(0x3C)
             inc8(REG_A);
-            break;
-        case 0x3D:
+            NEXT;
+        OPCODE(0x3D)
             dec8(REG_A);
-            break;
-        case 0x3E:
+            NEXT;
+        OPCODE(0x3E)
             regs_.load_byte(REG_A, arg.lsb);
-            break;
-        case 0x3F:
+            NEXT;
+        OPCODE(0x3F)
             ccf();
-            break;
-        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
-        case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F:
-        case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
-        case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
-        case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66: case 0x67:
-        case 0x68: case 0x69: case 0x6A: case 0x6B: case 0x6C: case 0x6D: case 0x6E: case 0x6F:
-        case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F:
+            NEXT;
+        OPCODE(0x40) OPCODE(0x41) OPCODE(0x42) OPCODE(0x43) OPCODE(0x44) OPCODE(0x45) OPCODE(0x46) OPCODE(0x47)
+        OPCODE(0x48) OPCODE(0x49) OPCODE(0x4A) OPCODE(0x4B) OPCODE(0x4C) OPCODE(0x4D) OPCODE(0x4E) OPCODE(0x4F)
+        OPCODE(0x50) OPCODE(0x51) OPCODE(0x52) OPCODE(0x53) OPCODE(0x54) OPCODE(0x55) OPCODE(0x56) OPCODE(0x57)
+        OPCODE(0x58) OPCODE(0x59) OPCODE(0x5A) OPCODE(0x5B) OPCODE(0x5C) OPCODE(0x5D) OPCODE(0x5E) OPCODE(0x5F)
+        OPCODE(0x60) OPCODE(0x61) OPCODE(0x62) OPCODE(0x63) OPCODE(0x64) OPCODE(0x65) OPCODE(0x66) OPCODE(0x67)
+        OPCODE(0x68) OPCODE(0x69) OPCODE(0x6A) OPCODE(0x6B) OPCODE(0x6C) OPCODE(0x6D) OPCODE(0x6E) OPCODE(0x6F)
+        OPCODE(0x78) OPCODE(0x79) OPCODE(0x7A) OPCODE(0x7B) OPCODE(0x7C) OPCODE(0x7D) OPCODE(0x7E) OPCODE(0x7F)
             if ( ( opcode & 0x7 ) != 6 )
                 regs_.load(( opcode >> 3 ) & 0x7, opcode & 0x7);
             else {
                 temp_w = regs_.read_short(HL);
                 regs_.load_byte((opcode >> 3) & 0x7, read_memory(temp_w));
             }
-            break;
-        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77:
+            NEXT;
+        OPCODE(0x70) OPCODE(0x71) OPCODE(0x72) OPCODE(0x73) OPCODE(0x74) OPCODE(0x75) OPCODE(0x77)
             write_memory(regs_.read_short(HL), regs_.read_byte(opcode & 0x7));
-            break;
-        case 0x76:
+            NEXT;
+        OPCODE(0x76)
             halt();
-            break;
-        case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87:
-        case 0x88: case 0x89: case 0x8A: case 0x8B: case 0x8C: case 0x8D: case 0x8E: case 0x8F:
-        case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
-        case 0x98: case 0x99: case 0x9A: case 0x9B: case 0x9C: case 0x9D: case 0x9E: case 0x9F:
-        case 0xA0: case 0xA1: case 0xA2: case 0xA3: case 0xA4: case 0xA5: case 0xA6: case 0xA7:
-        case 0xA8: case 0xA9: case 0xAA: case 0xAB: case 0xAC: case 0xAD: case 0xAE: case 0xAF:
-        case 0xB0: case 0xB1: case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB6: case 0xB7:
-        case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF:
-            (this->*alu_functions_[( opcode >> 3 ) & 0x7] )
-                    (( ( opcode & 0x7 ) != 6 ) ? regs_.read_byte(opcode & 0x7) : read_memory(regs_.read_short(HL)));
-            break;
-        case 0xC0:
+            NEXT;
+        OPCODE(0x80) OPCODE(0x81) OPCODE(0x82) OPCODE(0x83) OPCODE(0x84) OPCODE(0x85) OPCODE(0x86) OPCODE(0x87)
+            add(alu_operand(opcode));
+            NEXT;
+        OPCODE(0x88) OPCODE(0x89) OPCODE(0x8A) OPCODE(0x8B) OPCODE(0x8C) OPCODE(0x8D) OPCODE(0x8E) OPCODE(0x8F)
+            adc(alu_operand(opcode));
+            NEXT;
+        OPCODE(0x90) OPCODE(0x91) OPCODE(0x92) OPCODE(0x93) OPCODE(0x94) OPCODE(0x95) OPCODE(0x96) OPCODE(0x97)
+            sub(alu_operand(opcode));
+            NEXT;
+        OPCODE(0x98) OPCODE(0x99) OPCODE(0x9A) OPCODE(0x9B) OPCODE(0x9C) OPCODE(0x9D) OPCODE(0x9E) OPCODE(0x9F)
+            sbc(alu_operand(opcode));
+            NEXT;
+        OPCODE(0xA0) OPCODE(0xA1) OPCODE(0xA2) OPCODE(0xA3) OPCODE(0xA4) OPCODE(0xA5) OPCODE(0xA6) OPCODE(0xA7)
+            and_l(alu_operand(opcode));
+            NEXT;
+        OPCODE(0xA8) OPCODE(0xA9) OPCODE(0xAA) OPCODE(0xAB) OPCODE(0xAC) OPCODE(0xAD) OPCODE(0xAE) OPCODE(0xAF)
+            xor_l(alu_operand(opcode));
+            NEXT;
+        OPCODE(0xB0) OPCODE(0xB1) OPCODE(0xB2) OPCODE(0xB3) OPCODE(0xB4) OPCODE(0xB5) OPCODE(0xB6) OPCODE(0xB7)
+            or_l(alu_operand(opcode));
+            NEXT;
+        OPCODE(0xB8) OPCODE(0xB9) OPCODE(0xBA) OPCODE(0xBB) OPCODE(0xBC) OPCODE(0xBD) OPCODE(0xBE) OPCODE(0xBF)
+            cp(alu_operand(opcode));
+            NEXT;
+        OPCODE(0xC0)
             gb_.clock(4);
             if ( !regs_.zero() )
                 ret();
-            break;
-        case 0xC1:
+            NEXT;
+        OPCODE(0xC1)
             regs_.load_short(BC, stack_pop());
-            break;
-        case 0xC2:
+            NEXT;
+        OPCODE(0xC2)
             if ( !regs_.zero() )
                 jp(arg.word);
-            break;
-        case 0xC3:
+            NEXT;
+        OPCODE(0xC3)
             jp(arg.word);
-            break;
-        case 0xC4:
+            NEXT;
+        OPCODE(0xC4)
             if ( !regs_.zero() )
                 call(arg.word);
-            break;
-        case 0xC5:
+            NEXT;
+        OPCODE(0xC5)
             gb_.clock(4);
             stack_push(regs_.read_short(BC));
-            break;
-        case 0xC6:
+            NEXT;
+        OPCODE(0xC6)
             add(arg.lsb);
-            break;
-        case 0xC7:
+            NEXT;
+        OPCODE(0xC7)
             call(0x0000);
-            break;
-        case 0xC8:
+            NEXT;
+        OPCODE(0xC8)
             gb_.clock(4);
             if ( regs_.zero() )
                 ret();
-            break;
-        case 0xC9:
+            NEXT;
+        OPCODE(0xC9)
             ret();
-            break;
-        case 0xCA:
+            NEXT;
+        OPCODE(0xCA)
             if ( regs_.zero() )
                 jp(arg.word);
-            break;
-        case 0xCB:
+            NEXT;
+        OPCODE(0xCB)
             cb(arg.lsb);
-            break;
-        case 0xCC:
+            NEXT;
+        OPCODE(0xCC)
             if ( regs_.zero() )
                 call(arg.word);
-            break;
-        case 0xCD:
+            NEXT;
+        OPCODE(0xCD)
             call(arg.word);
-            break;
-        case 0xCE:
+            NEXT;
+        OPCODE(0xCE)
             adc(arg.lsb);
-            break;
-        case 0xCF:
+            NEXT;
+        OPCODE(0xCF)
             call(0x0008);
-            break;
-        case 0xD0:
+            NEXT;
+        OPCODE(0xD0)
             gb_.clock(4);
             if ( !regs_.carry() )
                 ret();
-            break;
-        case 0xD1:
+            NEXT;
+        OPCODE(0xD1)
             regs_.load_short(DE, stack_pop());
-            break;
-        case 0xD2:
+            NEXT;
+        OPCODE(0xD2)
             if ( !regs_.carry() )
                 jp(arg.word);
-            break;
-        case 0xD4:
+            NEXT;
+        OPCODE(0xD4)
             if ( !regs_.carry() )
                 call(arg.word);
-            break;
-        case 0xD5:
+            NEXT;
+        OPCODE(0xD5)
             gb_.clock(4);
             stack_push(regs_.read_short(DE));
-            break;
-        case 0xD6:
+            NEXT;
+        OPCODE(0xD6)
             sub(arg.lsb);
-            break;
-        case 0xD7:
+            NEXT;
+        OPCODE(0xD7)
             call(0x0010);
-            break;
-        case 0xD8:
+            NEXT;
+        OPCODE(0xD8)
             gb_.clock(4);
             if ( regs_.carry() )
                 ret();
-            break;
-        case 0xD9:
+            NEXT;
+        OPCODE(0xD9)
             reti();
-            break;
-        case 0xDA:
+            NEXT;
+        OPCODE(0xDA)
             if ( regs_.carry() )
                 jp(arg.word);
-            break;
-        case 0xDC:
+            NEXT;
+        OPCODE(0xDC)
             if ( regs_.carry() )
                 call(arg.word);
-            break;
-        case 0xDE:
+            NEXT;
+        OPCODE(0xDE)
             sbc(arg.lsb);
-            break;
-        case 0xDF:
+            NEXT;
+        OPCODE(0xDF)
             call(0x0018);
-            break;
-        case 0xE0:
+            NEXT;
+        OPCODE(0xE0)
             write_memory(0xFF00 + arg.lsb, regs_.read_byte(REG_A));
-            break;
-        case 0xE1:
+            NEXT;
+        OPCODE(0xE1)
             regs_.load_short(HL, stack_pop());
-            break;
-        case 0xE2:
+            NEXT;
+        OPCODE(0xE2)
             write_memory(0xFF00 + regs_.read_byte(REG_C), regs_.read_byte(REG_A));
-            break;
-        case 0xE5:
+            NEXT;
+        OPCODE(0xE5)
             gb_.clock(4);
             stack_push(regs_.read_short(HL));
-            break;
-        case 0xE6:
+            NEXT;
+        OPCODE(0xE6)
             and_l(arg.lsb);
-            break;
-        case 0xE7:
+            NEXT;
+        OPCODE(0xE7)
             call(0x0020);
-            break;
-        case 0xE8:
+            NEXT;
+        OPCODE(0xE8)
             add_sp_n((int8_t) arg.lsb);
-            break;
-        case 0xE9:
+            NEXT;
+        OPCODE(0xE9)
             pc_ = regs_.read_short(HL);
-            break;
-        case 0xEA:
+            NEXT;
+        OPCODE(0xEA)
             write_memory(arg.word, regs_.read_byte(REG_A));
-            break;
-        case 0xEE:
+            NEXT;
+        OPCODE(0xEE)
             xor_l(arg.lsb);
-            break;
-        case 0xEF:
+            NEXT;
+        OPCODE(0xEF)
             call(0x0028);
-            break;
-        case 0xF0:
+            NEXT;
+        OPCODE(0xF0)
             regs_.load_byte(REG_A, read_memory(0xFF00 + arg.lsb));
-            break;
-        case 0xF1:
+            NEXT;
+        OPCODE(0xF1)
             regs_.load_short(AF, stack_pop());
-            break;
-        case 0xF2:
+            NEXT;
+        OPCODE(0xF2)
             regs_.load_byte(REG_A, read_memory(0xFF00 + regs_.read_byte(REG_C)));
-            break;
-        case 0xF3:
+            NEXT;
+        OPCODE(0xF3)
             interrupts_->set_ime(false);
-            break;
-        case 0xF5:
+            NEXT;
+        OPCODE(0xF5)
             gb_.clock(4);
             stack_push(regs_.read_short(AF));
-            break;
-        case 0xF6:
+            NEXT;
+        OPCODE(0xF6)
             or_l(arg.lsb);
-            break;
-        case 0xF7:
+            NEXT;
+        OPCODE(0xF7)
             call(0x0030);
-            break;
-        case 0xF8:
+            NEXT;
+        OPCODE(0xF8)
             ldhl_sp_n((int8_t) arg.lsb);
-            break;
-        case 0xF9:
+            NEXT;
+        OPCODE(0xF9)
             gb_.clock(4);
             sp_ = regs_.read_short(HL);
-            break;
-        case 0xFA:
+            NEXT;
+        OPCODE(0xFA)
             regs_.load_byte(REG_A, read_memory(arg.word));
-            break;
-        case 0xFB:
+            NEXT;
+        OPCODE(0xFB)
             ei_last_instruction_ = true;
-            break;
-        case 0xFE:
+            NEXT;
+        OPCODE(0xFE)
             cp(arg.lsb);
-            break;
-        case 0xFF:
+            NEXT;
+        OPCODE(0xFF)
             call(0x0038);
-            break;
-        default:
-            break;
+            NEXT;
+        // Unused opcodes
+        OPCODE(0xD3) OPCODE(0xDB) OPCODE(0xDD) OPCODE(0xE3) OPCODE(0xE4) OPCODE(0xEB) OPCODE(0xEC) OPCODE(0xED)
+        OPCODE(0xF4) OPCODE(0xFC) OPCODE(0xFD)
+            NEXT;
+#ifndef OHBOI_COMPUTED_GOTO
     }
+#endif
 }
 
-void Cpu::update_timers(unsigned int cycles) {
-    this->div_counter_ += cycles << (double_speed_ ? 1 : 0);
-    if (this->div_counter_ >= 0xFF ) {
-        this->div_counter_ -= 0xFF;
-        this->div_reg_++;
+void Cpu::sync_timers() {
+    uint64_t now = gb_.scheduler_.now();
+    if ( now > timers_synced_ ) {
+        update_timers(now - timers_synced_);
+        timers_synced_ = now;
     }
+}
+
+void Cpu::timer_event() {
+    sync_timers();
+    schedule_timer_overflow();
+}
+
+// Same result as stepping the timers in slices of any size: DIV ticks every 255 counts of its counter, TIMA every
+// period of the selected frequency
+void Cpu::update_timers(uint64_t cycles) {
+    uint64_t div_total = div_counter_ + (cycles << (double_speed_ ? 1 : 0));
+    div_reg_ += static_cast<uint8_t>(div_total / 0xFF);
+    div_counter_ = static_cast<uint16_t>(div_total % 0xFF);
+
     if ( this->tac_.test(2) ) {
-        this->timer_counter_ -= cycles;
-        while (this->timer_counter_ <= 0 ) {
-            static int timer_counter_increments[4] = {
-                    1024, 16, 64, 256
-            };
-            timer_counter_ += timer_counter_increments[tac_.to_ulong() & 0x3];
-            if ( ++tima_ == 0 ) {
+        int64_t counter = timer_counter_ - static_cast<int64_t>(cycles);
+        if ( counter <= 0 ) {
+            int64_t period = timer_ctr_reset_values[tac_.to_ulong() & 0x3];
+            int64_t increments = -counter / period + 1;
+            if ( tima_ + increments > 0xFF )
                 timer_overflow_ = true;
-            }
+            tima_ = static_cast<uint8_t>(tima_ + increments);
+            counter += increments * period;
         }
+        timer_counter_ = static_cast<int>(counter);
     }
 }
 
-void Cpu::update_buttons() {
-    if ( (joypad_->buttons_enabled() && joypad_->buttons_pressed())
-        || (joypad_->direction_enabled() && joypad_->direction_pressed()) ) {
-            interrupts_->request(Interrupts::jpad);
+void Cpu::schedule_timer_overflow() {
+    if ( !tac_.test(2) ) {
+        gb_.scheduler_.cancel(Scheduler::timer);
+        return;
+    }
+    uint64_t period = timer_ctr_reset_values[tac_.to_ulong() & 0x3];
+    gb_.scheduler_.schedule(Scheduler::timer, timers_synced_ + timer_counter_ + (0xFF - tima_) * period);
+}
+
+// After catching up, the timestamp up to which (excluded) reads of DIV or TIMA are sure to return what they do now
+uint64_t Cpu::timer_stable_until(uint16_t addr) {
+    sync_timers();
+    if ( addr == gb::memory::io_ports::div_reg ) {
+        unsigned int shift = double_speed_ ? 1 : 0;
+        return timers_synced_ + ((0xFF - div_counter_ + (1 << shift) - 1) >> shift);
+    }
+    if ( !tac_.test(2) )
+        return std::numeric_limits<uint64_t>::max();
+    return timers_synced_ + timer_counter_;
+}
+
+/* Called every time execution goes back to the start of a polling loop (see polled_register). If the last iteration
+ * left every register as it found it, read the polled register while it couldn't change and took as long as the one
+ * before, the next ones will do exactly the same until the register changes or an event runs: they are skipped
+ * altogether, moving time forward by as many whole iterations as fit before either. */
+void Cpu::skip_idle_loop() {
+    uint64_t now = gb_.scheduler_.now();
+    std::array<uint16_t, 5> regs {regs_.read_short(BC), regs_.read_short(DE), regs_.read_short(HL),
+                                  regs_.read_short(AF), sp_};
+    bool same_block = idle_loop_.block_id == current_block_->id;
+    uint64_t period = now - idle_loop_.time;
+    unsigned int cycle_period = cycles_ - idle_loop_.cycles;
+    uint16_t addr = current_block_->polled_register;
+    uint64_t stable_until = (addr == gb::graphics::Ppu::lcd_status || addr == gb::graphics::Ppu::ly)
+                            ? gb_.gpu_->stable_until(addr)
+                            : timer_stable_until(addr);
+
+    if ( same_block && regs == idle_loop_.regs && now < idle_loop_.stable_until && period != 0 && cycle_period != 0
+         && period == idle_loop_.period && cycle_period == idle_loop_.cycle_period
+         && !ei_last_instruction_ && !timer_overflow_ && !halt_bug_triggered_ && !debug_ ) {
+        uint64_t horizon = std::min(stable_until, gb_.scheduler_.next_time() - 1);
+        uint64_t iterations = std::min<uint64_t>((horizon - now) / period, max_idle_skip / cycle_period);
+        if ( iterations > 0 ) {
+            gb_.scheduler_.advance(static_cast<unsigned int>(iterations * period));
+            cycles_ += static_cast<unsigned int>(iterations) * cycle_period;
+            now += iterations * period;
+            idle_loop_stats_.hits++;
+            idle_loop_stats_.cycles += iterations * cycle_period;
+        }
     }
+
+    idle_loop_ = {current_block_->id, now, stable_until, same_block ? period : 0, cycles_, cycle_period, regs};
+}
+
+// A selected group with a key down keeps requesting the joypad interrupt
+bool Cpu::joypad_held() const {
+    return (joypad_->buttons_enabled() && joypad_->buttons_pressed())
+           || (joypad_->direction_enabled() && joypad_->direction_pressed());
+}
+
+void Cpu::update_buttons() {
+    if ( joypad_held() )
+        interrupts_->request(Interrupts::jpad);
 }
 
 void Cpu::service_interrupts() {
@@ -640,93 +1051,50 @@ inline uint16_t Cpu::stack_pop() {
 
 void Cpu::add(uint8_t val) {
     uint8_t a = regs_.read_byte(REG_A);
-    uint8_t result = a + val;
-
-    regs_.set_zero(result == 0);
-    regs_.set_half_carry((a & 0xF) + (val & 0xF) > 0xF);
-    regs_.set_carry(result < a);
-    regs_.set_sub(false);
-
-    regs_.load_byte(REG_A, result);
+    regs_.set_add_flags(a, val, 0);
+    regs_.load_byte(REG_A, a + val);
 }
 
 void Cpu::adc(uint8_t val) {
     uint8_t a = regs_.read_byte(REG_A);
     uint8_t carry = regs_.carry() ? 1 : 0;
-
-    regs_.set_carry((uint16_t) a + val + carry > 0x00FF);
-    regs_.set_half_carry((a & 0xF) + (val & 0xF) + carry > 0xF);
-    a += ( val + carry );
-    regs_.set_zero(a == 0);
-    regs_.set_sub(false);
-
-    regs_.load_byte(REG_A, a);
+    regs_.set_add_flags(a, val, carry);
+    regs_.load_byte(REG_A, a + val + carry);
 }
 
 void Cpu::sub(uint8_t val) {
     uint8_t a = regs_.read_byte(REG_A);
-
-    regs_.set_zero(a == val);
-    regs_.set_half_carry((val & 0xF) > (a & 0xF));
-    regs_.set_carry(val > a);
-    regs_.set_sub(true);
-
+    regs_.set_sub_flags(a, val, 0);
     regs_.load_byte(REG_A, a - val);
 }
 
 void Cpu::sbc(uint8_t val) {
     uint8_t a = regs_.read_byte(REG_A);
     uint8_t carry = regs_.carry() ? 1 : 0;
-
-    regs_.set_half_carry((a & 0xF) < (val & 0xF) + carry);
-    regs_.set_carry((uint16_t) a < (uint16_t) val + carry);
-    a -= ( val + carry );
-    regs_.set_zero(a == 0);
-    regs_.set_sub(true);
-
-    regs_.load_byte(REG_A, a);
+    regs_.set_sub_flags(a, val, carry);
+    regs_.load_byte(REG_A, a - val - carry);
 }
 
 void Cpu::and_l(uint8_t val) {
     uint8_t res = regs_.read_byte(REG_A) & val;
-
-    regs_.set_zero(res == 0);
-    regs_.set_sub(false);
-    regs_.set_half_carry(true);
-    regs_.set_carry(false);
-
+    regs_.set_logic_flags(res, true);
     regs_.load_byte(REG_A, res);
 }
 
 void Cpu::or_l(uint8_t val) {
     uint8_t res = regs_.read_byte(REG_A) | val;
-
-    regs_.set_zero(res == 0);
-    regs_.set_sub(false);
-    regs_.set_half_carry(false);
-    regs_.set_carry(false);
-
+    regs_.set_logic_flags(res, false);
     regs_.load_byte(REG_A, res);
 }
 
 void Cpu::xor_l(uint8_t val) {
     uint8_t res = regs_.read_byte(REG_A) ^ val;
-
-    regs_.set_zero(res == 0);
-    regs_.set_sub(false);
-    regs_.set_half_carry(false);
-    regs_.set_carry(false);
-
+    regs_.set_logic_flags(res, false);
     regs_.load_byte(REG_A, res);
 }
 
 void Cpu::cp(uint8_t val) {
-    uint8_t a = regs_.read_byte(REG_A);
-
-    regs_.set_zero(a == val);
-    regs_.set_sub(true);
-    regs_.set_half_carry((a & 0xF) < (val & 0xF));
-    regs_.set_carry(a < val);
+    regs_.set_sub_flags(regs_.read_byte(REG_A), val, 0);
 }
 
 void Cpu::add_hl(uint16_t val) {
@@ -739,20 +1107,14 @@ void Cpu::add_hl(uint16_t val) {
 }
 
 void Cpu::inc8(int r) {
-    uint8_t reg = regs_.read_byte(r);
-    regs_.set_half_carry((reg & 0xF) == 0xF);
-    ++reg;
-    regs_.set_zero(reg == 0);
-    regs_.set_sub(false);
+    uint8_t reg = regs_.read_byte(r) + 1;
+    regs_.set_inc_flags(reg);
     regs_.load_byte(r, reg);
 }
 
 void Cpu::dec8(int r) {
-    uint8_t reg = regs_.read_byte(r);
-    regs_.set_half_carry((reg & 0xF) == 0);
-    --reg;
-    regs_.set_zero(reg == 0);
-    regs_.set_sub(true);
+    uint8_t reg = regs_.read_byte(r) - 1;
+    regs_.set_dec_flags(reg);
     regs_.load_byte(r, reg);
 }
 
@@ -938,41 +1300,49 @@ void Cpu::reti() {
     interrupts_->set_ime(true);
 }
 
-void Cpu::cb(uint8_t opcode) {
-    switch ( ( opcode & 0xC0 ) >> 6 ) {
-        case 0:
-            if ( ( opcode & 0x7 ) != 6 )
-                if ( ( ( opcode >> 3 ) & 0x7 ) == 0x7 && ( opcode & 0x7 ) == 7 )
-                    srl_a();
-                else {
-                    uint8_t val = regs_.read_byte(opcode & 0x7);
-                    uint8_t res = (this->*rotate_instructions_[( opcode >> 3 ) & 0x7] )(val);
-                    regs_.load_byte(opcode & 0x7, res);
-                }
-            else {
-                uint8_t res = read_memory(regs_.read_short(HL));
-                res = (this->*rotate_instructions_[( opcode >> 3 ) & 0x7] )(res);
-                write_memory(regs_.read_short(HL), res);
-            }
-            break;
-        case 1:
-            bit(( opcode >> 3 ) & 0x7,
-                ( opcode & 0x7 ) != 6 ? regs_.read_byte(opcode & 0x7)
-                                          : read_memory(regs_.read_short(HL)));
-            break;
-        case 2:
-            if ( ( opcode & 0x7 ) != 6 )
-                regs_.load_byte(opcode & 0x7, res((opcode >> 3) & 0x7, regs_.read_byte(opcode & 0x7)));
-            else
-                write_memory(regs_.read_short(HL), res(( opcode >> 3 ) & 0x7, read_memory(regs_.read_short(HL))));
-            break;
-        case 3:
-            if ( ( opcode & 0x7 ) != 6 )
-                regs_.load_byte(opcode & 0x7, set((opcode >> 3) & 0x7, regs_.read_byte(opcode & 0x7)));
-            else
-                write_memory(regs_.read_short(HL), set(( opcode >> 3 ) & 0x7, read_memory(regs_.read_short(HL))));
-            break;
+template <uint8_t opcode>
+void Cpu::cb_op() {
+    constexpr unsigned int reg = opcode & 0x7;
+    constexpr int n = ( opcode >> 3 ) & 0x7;
+
+    uint8_t val;
+    if constexpr ( reg != 6 )
+        val = regs_.read_byte(reg);
+    else
+        val = read_memory(regs_.read_short(HL));
+
+    if constexpr ( opcode < 0x40 ) {
+        if constexpr ( n == 0 ) val = rlc(val);
+        else if constexpr ( n == 1 ) val = rrc(val);
+        else if constexpr ( n == 2 ) val = rl(val);
+        else if constexpr ( n == 3 ) val = rr(val);
+        else if constexpr ( n == 4 ) val = sla(val);
+        else if constexpr ( n == 5 ) val = sra(val);
+        else if constexpr ( n == 6 ) val = swap(val);
+        else val = srl(val);
+    } else if constexpr ( opcode < 0x80 ) {
+        bit(n, val);
+        return;
+    } else if constexpr ( opcode < 0xC0 ) {
+        val = res(n, val);
+    } else {
+        val = set(n, val);
     }
+
+    if constexpr ( reg != 6 )
+        regs_.load_byte(reg, val);
+    else
+        write_memory(regs_.read_short(HL), val);
+}
+
+template <size_t... opcodes>
+constexpr std::array<Cpu::Cb_handler, sizeof...(opcodes)> Cpu::make_cb_table(std::index_sequence<opcodes...>) {
+    return { &Cpu::cb_op<opcodes>... };
+}
+
+void Cpu::cb(uint8_t opcode) {
+    static constexpr auto cb_table = make_cb_table(std::make_index_sequence<0x100>{});
+    (this->*cb_table[opcode])();
 }
 
 uint8_t Cpu::rlc(uint8_t val) {
@@ -1078,14 +1448,8 @@ void Cpu::bit(int n, uint8_t val) {
     regs_.set_half_carry(true);
 }
 
-void Cpu::srl_a() {
-    uint8_t a = regs_.read_byte(REG_A);
-    regs_.set_carry(a & 1);
-    a >>= 1;
-    regs_.set_zero(a == 0);
-    regs_.set_sub(false);
-    regs_.set_half_carry(false);
-    regs_.load_byte(REG_A, a);
+inline uint8_t Cpu::alu_operand(uint8_t opcode) {
+    return ( opcode & 0x7 ) != 6 ? regs_.read_byte(opcode & 0x7) : read_memory(regs_.read_short(HL));
 }
 
 void Cpu::write_memory(unsigned int addr, uint8_t val) {
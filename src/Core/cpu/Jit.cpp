@@ -0,0 +1,531 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#include "Core/Cpu/Jit.h"
+
+#ifdef OHBOI_JIT
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Core/Cpu/Registers.h"
+
+using gb::cpu::Jit;
+using gb::cpu::Registers;
+
+namespace {
+    // Scratch registers of the generated code. rdi points to the Registers and rsi to the stack pointer, the System V
+    // ABI passes the two arguments there, and nothing else is touched: no prologue, no stack.
+    enum Reg : uint8_t { eax = 0, ecx = 1, edx = 2 };
+    constexpr uint8_t rsi = 6;
+    constexpr uint8_t rdi = 7;
+
+    // The /n of the group 1 instructions, op r/m32, r32 is 8 * n + 1
+    enum Alu : uint8_t { add_op = 0, or_op = 1, and_op = 4, sub_op = 5, xor_op = 6, cmp_op = 7 };
+
+    constexpr uint8_t zero = 1 << ZERO_FLAG;
+    constexpr uint8_t subtract = 1 << SUB_FLAG;
+    constexpr uint8_t half_carry = 1 << HALF_CARRY_FLAG;
+    constexpr uint8_t carry = 1 << CARRY_FLAG;
+
+    class Emitter {
+    public:
+        explicit Emitter(std::vector<uint8_t> &code) : code_(code) {}
+
+        // movzx r32, byte [rdi + r] and back, r being one of the 8-bit registers
+        void load(Reg dst, unsigned int r) { bytes({0x0F, 0xB6}); reg_operand(dst, r); }
+        void store(unsigned int r, Reg src) { bytes({0x88}); reg_operand(src, r); }
+        void store_imm(unsigned int r, uint8_t val) { bytes({0xC6}); reg_operand(0, r); bytes({val}); }
+
+        // Same for a 16-bit pair, where SP is the one rsi points to
+        void load16(Reg dst, unsigned int pair) { bytes({0x0F, 0xB7}); pair_operand(dst, pair); }
+        void store16(unsigned int pair, Reg src) { bytes({0x66, 0x89}); pair_operand(src, pair); }
+        void store16_imm(unsigned int pair, uint16_t val) {
+            bytes({0x66, 0xC7});
+            pair_operand(0, pair);
+            bytes({static_cast<uint8_t>(val), static_cast<uint8_t>(val >> 8)});
+        }
+
+        void mov(Reg dst, Reg src) { bytes({0x89, modrm(3, src, dst)}); }
+        void mov_imm(Reg dst, uint32_t val) { bytes({static_cast<uint8_t>(0xB8 + dst)}); imm32(val); }
+        void alu(Alu op, Reg dst, Reg src) { bytes({static_cast<uint8_t>(op * 8 + 1), modrm(3, src, dst)}); }
+        void alu_imm(Alu op, Reg dst, uint32_t val) { bytes({0x81, modrm(3, op, dst)}); imm32(val); }
+        void test_imm(Reg r, uint32_t val) { bytes({0xF7, modrm(3, 0, r)}); imm32(val); }
+        void shl(Reg r, uint8_t count) { bytes({0xC1, modrm(3, 4, r), count}); }
+        void shr(Reg r, uint8_t count) { bytes({0xC1, modrm(3, 5, r), count}); }
+        void neg(Reg r) { bytes({0xF7, modrm(3, 3, r)}); }
+        void not_(Reg r) { bytes({0xF7, modrm(3, 2, r)}); }
+        // r = (zero flag of the last test or arithmetic) << bit, through sete and movzx
+        void set_if_zero(Reg r, unsigned int bit) {
+            bytes({0x0F, 0x94, modrm(3, 0, r), 0x0F, 0xB6, modrm(3, r, r)});
+            if ( bit != 0 )
+                shl(r, bit);
+        }
+        void ret() { bytes({0xC3}); }
+    private:
+        std::vector<uint8_t> &code_;
+
+        static uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm) { return (mod << 6) | (reg << 3) | rm; }
+        void bytes(std::initializer_list<uint8_t> b) { code_.insert(code_.end(), b); }
+        void imm32(uint32_t v) {
+            for ( int i = 0; i < 4; i++ )
+                code_.push_back(static_cast<uint8_t>(v >> (i * 8)));
+        }
+        // [rdi + disp8], every register sits well within the first 128 bytes of the object
+        void reg_operand(uint8_t reg, unsigned int r) {
+            bytes({modrm(1, reg, rdi), static_cast<uint8_t>(Registers::offset_of(r))});
+        }
+        void pair_operand(uint8_t reg, unsigned int pair) {
+            if ( pair == SP )
+                bytes({modrm(0, reg, rsi)});
+            else
+                reg_operand(reg, pair == BC ? REG_C : pair == DE ? REG_E : REG_L);
+        }
+    };
+
+    // The right operand of the 8-bit ALU operations, a register or an immediate
+    void alu_operand(Emitter &e, Reg dst, uint8_t opcode, gb::cpu::Instr_argument arg) {
+        if ( opcode >= 0xC0 )
+            e.mov_imm(dst, arg.lsb);
+        else
+            e.load(dst, opcode & 7);
+    }
+
+    /* add, adc, sub, sbc and cp work on 32-bit values, where a ^ val ^ result has the carry (or borrow) out of the low
+     * nibble in bit 4 and the one out of the byte in bit 8 */
+    void arithmetic(Emitter &e, unsigned int op, uint8_t opcode, gb::cpu::Instr_argument arg) {
+        bool sub = op == 2 || op == 3 || op == 7;
+        e.load(eax, REG_A);
+        alu_operand(e, ecx, opcode, arg);
+        if ( op == 1 || op == 3 ) {
+            e.load(edx, REG_F);
+            e.shr(edx, CARRY_FLAG);
+            e.alu_imm(and_op, edx, 1);
+            if ( sub )
+                e.neg(edx);
+            e.alu(add_op, edx, eax);
+        } else {
+            e.mov(edx, eax);
+        }
+        e.alu(sub ? sub_op : add_op, edx, ecx);
+        if ( op != 7 )
+            e.store(REG_A, edx);
+
+        e.alu(xor_op, eax, ecx);
+        e.alu(xor_op, eax, edx);
+        e.test_imm(edx, 0xFF);
+        e.set_if_zero(ecx, ZERO_FLAG);
+        e.mov(edx, eax);
+        e.alu_imm(and_op, edx, 0x10);
+        e.shl(edx, HALF_CARRY_FLAG - 4);
+        e.alu(or_op, ecx, edx);
+        e.alu_imm(and_op, eax, 0x100);
+        e.shr(eax, 8 - CARRY_FLAG);
+        e.alu(or_op, ecx, eax);
+        if ( sub )
+            e.alu_imm(or_op, ecx, subtract);
+        e.store(REG_F, ecx);
+    }
+
+    void logic(Emitter &e, unsigned int op, uint8_t opcode, gb::cpu::Instr_argument arg) {
+        e.load(eax, REG_A);
+        alu_operand(e, ecx, opcode, arg);
+        e.alu(op == 4 ? and_op : op == 5 ? xor_op : or_op, eax, ecx);
+        e.store(REG_A, eax);
+        e.test_imm(eax, 0xFF);
+        e.set_if_zero(ecx, ZERO_FLAG);
+        if ( op == 4 )
+            e.alu_imm(or_op, ecx, half_carry);
+        e.store(REG_F, ecx);
+    }
+
+    // inc and dec keep the carry
+    void inc_dec(Emitter &e, unsigned int r, bool inc) {
+        e.load(eax, r);
+        e.alu_imm(inc ? add_op : sub_op, eax, 1);
+        e.store(r, eax);
+        e.load(edx, REG_F);
+        e.alu_imm(and_op, edx, carry);
+        e.test_imm(eax, 0xFF);
+        e.set_if_zero(ecx, ZERO_FLAG);
+        e.alu(or_op, edx, ecx);
+        if ( inc ) {
+            e.test_imm(eax, 0x0F);
+        } else {
+            e.alu_imm(and_op, eax, 0x0F);
+            e.alu_imm(cmp_op, eax, 0x0F);
+        }
+        e.set_if_zero(ecx, HALF_CARRY_FLAG);
+        e.alu(or_op, edx, ecx);
+        if ( !inc )
+            e.alu_imm(or_op, edx, subtract);
+        e.store(REG_F, edx);
+    }
+
+    // The carry comes from bit 11 into bit 12 and out of bit 15, the zero flag stays
+    void add_hl(Emitter &e, unsigned int pair) {
+        e.load16(eax, HL);
+        e.load16(ecx, pair);
+        e.mov(edx, eax);
+        e.alu(add_op, edx, ecx);
+        e.store16(HL, edx);
+        e.alu(xor_op, eax, ecx);
+        e.alu(xor_op, eax, edx);
+        e.load(edx, REG_F);
+        e.alu_imm(and_op, edx, zero);
+        e.mov(ecx, eax);
+        e.alu_imm(and_op, ecx, 0x1000);
+        e.shr(ecx, 12 - HALF_CARRY_FLAG);
+        e.alu(or_op, edx, ecx);
+        e.alu_imm(and_op, eax, 0x10000);
+        e.shr(eax, 16 - CARRY_FLAG);
+        e.alu(or_op, edx, eax);
+        e.store(REG_F, edx);
+    }
+
+    /* Rotates and shifts in CB order (rlc, rrc, rl, rr, sla, sra, swap, srl). The result is left in eax and the bit
+     * shifted out in ecx. rlca, rrca, rla and rra are the first four on A, except that they always clear Z. */
+    void shift(Emitter &e, unsigned int op, unsigned int r, bool cb) {
+        e.load(eax, r);
+        switch ( op ) {
+            case 0:
+                e.mov(ecx, eax);
+                e.shr(ecx, 7);
+                e.shl(eax, 1);
+                e.alu(or_op, eax, ecx);
+                break;
+            case 1:
+                e.mov(ecx, eax);
+                e.alu_imm(and_op, ecx, 1);
+                e.mov(edx, ecx);
+                e.shl(edx, 7);
+                e.shr(eax, 1);
+                e.alu(or_op, eax, edx);
+                break;
+            case 2:
+                e.load(edx, REG_F);
+                e.shr(edx, CARRY_FLAG);
+                e.alu_imm(and_op, edx, 1);
+                e.mov(ecx, eax);
+                e.shr(ecx, 7);
+                e.shl(eax, 1);
+                e.alu(or_op, eax, edx);
+                break;
+            case 3:
+                e.load(edx, REG_F);
+                e.shr(edx, CARRY_FLAG);
+                e.alu_imm(and_op, edx, 1);
+                e.shl(edx, 7);
+                e.mov(ecx, eax);
+                e.alu_imm(and_op, ecx, 1);
+                e.shr(eax, 1);
+                e.alu(or_op, eax, edx);
+                break;
+            case 4:
+                e.mov(ecx, eax);
+                e.shr(ecx, 7);
+                e.shl(eax, 1);
+                break;
+            case 5:
+                e.mov(ecx, eax);
+                e.alu_imm(and_op, ecx, 1);
+                e.mov(edx, eax);
+                e.alu_imm(and_op, edx, 0x80);
+                e.shr(eax, 1);
+                e.alu(or_op, eax, edx);
+                break;
+            case 6:
+                e.mov(ecx, eax);
+                e.shl(eax, 4);
+                e.shr(ecx, 4);
+                e.alu(or_op, eax, ecx);
+                e.alu(xor_op, ecx, ecx);
+                break;
+            default:
+                e.mov(ecx, eax);
+                e.alu_imm(and_op, ecx, 1);
+                e.shr(eax, 1);
+                break;
+        }
+        e.store(r, eax);
+        e.mov(edx, ecx);
+        e.shl(edx, CARRY_FLAG);
+        if ( cb ) {
+            e.test_imm(eax, 0xFF);
+            e.set_if_zero(ecx, ZERO_FLAG);
+            e.alu(or_op, edx, ecx);
+        }
+        e.store(REG_F, edx);
+    }
+
+    void cb(Emitter &e, uint8_t opcode) {
+        unsigned int r = opcode & 7;
+        unsigned int n = (opcode >> 3) & 7;
+        if ( opcode < 0x40 ) {
+            shift(e, n, r, true);
+        } else if ( opcode < 0x80 ) {
+            e.load(eax, r);
+            e.load(edx, REG_F);
+            e.alu_imm(and_op, edx, carry);
+            e.alu_imm(or_op, edx, half_carry);
+            e.test_imm(eax, 1 << n);
+            e.set_if_zero(ecx, ZERO_FLAG);
+            e.alu(or_op, edx, ecx);
+            e.store(REG_F, edx);
+        } else {
+            e.load(eax, r);
+            if ( opcode < 0xC0 )
+                e.alu_imm(and_op, eax, ~(1u << n));
+            else
+                e.alu_imm(or_op, eax, 1u << n);
+            e.store(r, eax);
+        }
+    }
+
+    void translate(Emitter &e, const gb::cpu::Block_cache::Instruction &instruction) {
+        uint8_t op = instruction.opcode;
+        if ( op >= 0x40 && op < 0x80 ) {                                    // ld r, r'
+            if ( ((op >> 3) & 7) != (op & 7) ) {
+                e.load(eax, op & 7);
+                e.store((op >> 3) & 7, eax);
+            }
+            return;
+        }
+        if ( (op >= 0x80 && op < 0xC0) || (op >= 0xC0 && (op & 7) == 6) ) { // alu a, r and alu a, n
+            unsigned int alu = (op >> 3) & 7;
+            if ( alu >= 4 && alu <= 6 )
+                logic(e, alu, op, instruction.arg);
+            else
+                arithmetic(e, alu, op, instruction.arg);
+            return;
+        }
+        switch ( op ) {
+            case 0x01: case 0x11: case 0x21: case 0x31:
+                e.store16_imm(op >> 4, instruction.arg.word);
+                break;
+            case 0x03: case 0x13: case 0x23: case 0x33:
+            case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+                e.load16(eax, op >> 4);
+                e.alu_imm((op & 0x08) ? sub_op : add_op, eax, 1);
+                e.store16(op >> 4, eax);
+                break;
+            case 0x09: case 0x19: case 0x29: case 0x39:
+                add_hl(e, op >> 4);
+                break;
+            case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C:
+                inc_dec(e, (op >> 3) & 7, true);
+                break;
+            case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D:
+                inc_dec(e, (op >> 3) & 7, false);
+                break;
+            case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+                e.store_imm((op >> 3) & 7, instruction.arg.lsb);
+                break;
+            case 0x07: case 0x0F: case 0x17: case 0x1F:
+                shift(e, op >> 3, REG_A, false);
+                break;
+            case 0x2F:                                                      // cpl
+                e.load(eax, REG_A);
+                e.not_(eax);
+                e.store(REG_A, eax);
+                e.load(edx, REG_F);
+                e.alu_imm(or_op, edx, subtract | half_carry);
+                e.store(REG_F, edx);
+                break;
+            case 0x37:                                                      // scf
+                e.load(edx, REG_F);
+                e.alu_imm(and_op, edx, zero);
+                e.alu_imm(or_op, edx, carry);
+                e.store(REG_F, edx);
+                break;
+            case 0x3F:                                                      // ccf
+                e.load(edx, REG_F);
+                e.alu_imm(xor_op, edx, carry);
+                e.alu_imm(and_op, edx, zero | carry);
+                e.store(REG_F, edx);
+                break;
+            case 0xCB:
+                cb(e, instruction.arg.lsb);
+                break;
+            default:                                                        // nop
+                break;
+        }
+    }
+
+    // inc rr, dec rr and add hl, rr clock the machine once more on top of their bytes
+    unsigned int clocks(const gb::cpu::Block_cache::Instruction &instruction) {
+        uint8_t op = instruction.opcode;
+        return instruction.length + ((op & 0xC7) == 0x03 || (op & 0xCF) == 0x09 ? 1 : 0);
+    }
+}
+
+std::unique_ptr<Jit> Jit::create() {
+    int fd = memfd_create("ohboi-jit", MFD_CLOEXEC);
+    if ( fd < 0 )
+        return nullptr;
+    void *writable = MAP_FAILED, *executable = MAP_FAILED;
+    if ( ftruncate(fd, arena_size) == 0 ) {
+        writable = mmap(nullptr, arena_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        executable = mmap(nullptr, arena_size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    }
+    if ( writable == MAP_FAILED || executable == MAP_FAILED ) {
+        if ( writable != MAP_FAILED )
+            munmap(writable, arena_size);
+        if ( executable != MAP_FAILED )
+            munmap(executable, arena_size);
+        close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<Jit>(new Jit(fd, static_cast<uint8_t *>(writable), static_cast<uint8_t *>(executable)));
+}
+
+Jit::Jit(int fd, uint8_t *writable, uint8_t *executable)
+    : fd_(fd),
+      writable_(writable),
+      executable_(executable),
+      arena_used_(0),
+      compiled_(0),
+      results_ready_(false),
+      stop_(false),
+      worker_(&Jit::work, this) {}
+
+Jit::~Jit() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    jobs_available_.notify_one();
+    worker_.join();
+
+    munmap(writable_, arena_size);
+    munmap(executable_, arena_size);
+    close(fd_);
+}
+
+// Everything Cpu counts as register-only but daa, whose flags aren't worth translating
+bool Jit::translates(const Block_cache::Instruction &instruction) {
+    uint8_t op = instruction.opcode;
+    if ( op >= 0x40 && op < 0x80 )
+        return (op & 7) != 6 && ((op >> 3) & 7) != 6;
+    if ( op >= 0x80 && op < 0xC0 )
+        return (op & 7) != 6;
+    switch ( op ) {
+        case 0x00:
+        case 0x01: case 0x11: case 0x21: case 0x31:
+        case 0x03: case 0x13: case 0x23: case 0x33:
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+        case 0x09: case 0x19: case 0x29: case 0x39:
+        case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C:
+        case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D:
+        case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+        case 0x07: case 0x0F: case 0x17: case 0x1F:
+        case 0x2F: case 0x37: case 0x3F:
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            return true;
+        case 0xCB:
+            return (instruction.arg.lsb & 7) != 6;
+        default:
+            return false;
+    }
+}
+
+void Jit::mark_runs(Block_cache::Block &block) {
+    unsigned int length = 0;
+    for ( auto it = block.instructions.rbegin(); it != block.instructions.rend(); ++it ) {
+        length = translates(*it) ? std::min(length + 1, 255u) : 0;
+        it->run_length = static_cast<uint8_t>(length);
+    }
+}
+
+const Jit::Run *Jit::lookup(const Block_cache::Block &block, size_t pos) {
+    install_results();
+
+    auto &entry = entries_[key(block, pos)];
+    if ( entry.run.fn != nullptr )
+        return &entry.run;
+
+    if ( !entry.queued && ++entry.hits >= hot_threshold ) {
+        entry.queued = true;
+        auto first = block.instructions.begin() + static_cast<std::ptrdiff_t>(pos);
+        {
+            std::lock_guard lock(mutex_);
+            jobs_.push_back({key(block, pos), {first, first + first->run_length}});
+        }
+        jobs_available_.notify_one();
+    }
+    return nullptr;
+}
+
+void Jit::install_results() {
+    if ( !results_ready_.load(std::memory_order_acquire) )
+        return;
+    std::unique_lock lock(mutex_, std::try_to_lock);
+    if ( !lock.owns_lock() )
+        return;
+
+    // A run that didn't fit in the arena stays queued, so the interpreter keeps it for good
+    for ( const auto &result : results_ ) {
+        entries_[result.key].run = result.run;
+        if ( result.run.fn != nullptr )
+            compiled_++;
+    }
+    results_.clear();
+    results_ready_.store(false, std::memory_order_relaxed);
+}
+
+void Jit::work() {
+    std::unique_lock lock(mutex_);
+    while ( true ) {
+        jobs_available_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if ( stop_ )
+            return;
+
+        Job job = std::move(jobs_.front());
+        jobs_.pop_front();
+        lock.unlock();
+        Run run = compile(job);
+        lock.lock();
+        results_.push_back({job.key, run});
+        results_ready_.store(true, std::memory_order_release);
+        // Written out once the queue runs dry rather than line by line
+        if ( jobs_.empty() && perf_map_.is_open() )
+            perf_map_.flush();
+    }
+}
+
+Jit::Run Jit::compile(const Job &job) {
+    std::vector<uint8_t> code;
+    Emitter e(code);
+    Run run{nullptr, 0, 0, 0, 0};
+    for ( const auto &instruction : job.instructions ) {
+        translate(e, instruction);
+        run.instructions++;
+        run.bytes += instruction.length;
+        run.clocks += clocks(instruction);
+        run.cycles += instruction.cycles;
+    }
+    e.ret();
+
+    size_t start = (arena_used_ + 15) & ~size_t{15};
+    if ( start + code.size() > arena_size )
+        return run;
+    std::memcpy(writable_ + start, code.data(), code.size());
+    arena_used_ = start + code.size();
+    run.fn = reinterpret_cast<Run_fn>(executable_ + start);
+
+    // Let perf attribute samples in the generated code to the run it came from
+    if ( !perf_map_.is_open() )
+        perf_map_.open("/tmp/perf-" + std::to_string(getpid()) + ".map", std::ios::app);
+    if ( perf_map_ ) {
+        perf_map_ << std::hex << reinterpret_cast<uintptr_t>(run.fn) << ' ' << code.size() << " ohboi_run_"
+                  << job.instructions.front().addr << "_block" << std::dec << (job.key >> 8) << '\n';
+    }
+    return run;
+}
+
+#endif
@@ -9,6 +9,13 @@ gb::cpu::Registers::Registers() : Registers(false) {}
 gb::cpu::Registers::Registers(bool cgb)
         : a(cgb ? 0x11 : 0x01),
           flags(0xB0),
+#ifdef OHBOI_LAZY_FLAGS
+          flag_op(Flag_op::none),
+          flag_a(0),
+          flag_val(0),
+          flag_carry(0),
+          flag_result(0),
+#endif
           bc(0x0013),
           de(0x00D8),
           hl(0x014D) {}
@@ -26,7 +33,11 @@ uint8_t gb::cpu::Registers::read_byte(unsigned int r) const {
         case REG_E:
             return e;
         case REG_F:
-            return flags.to_ulong() & 0xF0;
+#ifdef OHBOI_LAZY_FLAGS
+            return evaluate_flags();
+#else
+            return flags & 0xF0;
+#endif
         case REG_H:
             return h;
         case REG_L:
@@ -54,6 +65,9 @@ void gb::cpu::Registers::load_byte(unsigned int r, uint8_t val) {
             e = val;
             break;
         case REG_F:
+#ifdef OHBOI_LAZY_FLAGS
+            flag_op = Flag_op::none;
+#endif
             flags = val & 0xF0;
             break;
         case REG_H:
@@ -70,7 +84,11 @@ void gb::cpu::Registers::load_byte(unsigned int r, uint8_t val) {
 uint16_t gb::cpu::Registers::read_short(unsigned int r) const {
     switch (r) {
         case AF:
-            return ((uint16_t) a << 8) | (flags.to_ulong() & 0xF0);
+#ifdef OHBOI_LAZY_FLAGS
+            return ((uint16_t) a << 8) | evaluate_flags();
+#else
+            return ((uint16_t) a << 8) | (flags & 0xF0);
+#endif
         case BC:
             return bc;
         case DE:
@@ -86,6 +104,9 @@ void gb::cpu::Registers::load_short(unsigned int r, uint16_t val) {
     switch (r) {
         case AF:
             a = (val & 0xFF00) >> 8;
+#ifdef OHBOI_LAZY_FLAGS
+            flag_op = Flag_op::none;
+#endif
             flags = (val & 0xF0);
             break;
         case BC:
@@ -102,36 +123,70 @@ void gb::cpu::Registers::load_short(unsigned int r, uint16_t val) {
     }
 }
 
-bool gb::cpu::Registers::zero() const {
-    return flags.test(ZERO_FLAG);
+void gb::cpu::Registers::set_zero(bool val) {
+#ifdef OHBOI_LAZY_FLAGS
+    flush_flags();
+#endif
+    assign_flag(ZERO_FLAG, val);
 }
 
-bool gb::cpu::Registers::sub() const {
-    return flags.test(SUB_FLAG);
+void gb::cpu::Registers::set_sub(bool val) {
+#ifdef OHBOI_LAZY_FLAGS
+    flush_flags();
+#endif
+    assign_flag(SUB_FLAG, val);
 }
 
-bool gb::cpu::Registers::half_carry() const {
-    return flags.test(HALF_CARRY_FLAG);
+void gb::cpu::Registers::set_half_carry(bool val) {
+#ifdef OHBOI_LAZY_FLAGS
+    flush_flags();
+#endif
+    assign_flag(HALF_CARRY_FLAG, val);
 }
 
-bool gb::cpu::Registers::carry() const {
-    return flags.test(CARRY_FLAG);
+void gb::cpu::Registers::set_carry(bool val) {
+#ifdef OHBOI_LAZY_FLAGS
+    flush_flags();
+#endif
+    assign_flag(CARRY_FLAG, val);
 }
 
-void gb::cpu::Registers::set_zero(bool val) {
-    flags.set(ZERO_FLAG, val);
+#ifdef OHBOI_LAZY_FLAGS
+uint8_t gb::cpu::Registers::evaluate_flags() const {
+    return (zero() << ZERO_FLAG) | (sub() << SUB_FLAG) | (half_carry() << HALF_CARRY_FLAG) | (carry() << CARRY_FLAG);
 }
 
-void gb::cpu::Registers::set_sub(bool val) {
-    flags.set(SUB_FLAG, val);
-}
+#endif
 
-void gb::cpu::Registers::set_half_carry(bool val) {
-    flags.set(HALF_CARRY_FLAG, val);
+// Works out the flags of the pending operation, before one of them is set on its own or F is overwritten
+void gb::cpu::Registers::flush_flags() {
+#ifdef OHBOI_LAZY_FLAGS
+    if ( flag_op == Flag_op::none )
+        return;
+    flags = evaluate_flags();
+    flag_op = Flag_op::none;
+#endif
 }
 
-void gb::cpu::Registers::set_carry(bool val) {
-    flags.set(CARRY_FLAG, val);
+size_t gb::cpu::Registers::offset_of(unsigned int r) {
+    switch (r) {
+        case REG_A:
+            return offsetof(Registers, a);
+        case REG_B:
+            return offsetof(Registers, b);
+        case REG_C:
+            return offsetof(Registers, c);
+        case REG_D:
+            return offsetof(Registers, d);
+        case REG_E:
+            return offsetof(Registers, e);
+        case REG_F:
+            return offsetof(Registers, flags);
+        case REG_H:
+            return offsetof(Registers, h);
+        default:
+            return offsetof(Registers, l);
+    }
 }
 
 void gb::cpu::Registers::load(unsigned int dest, unsigned int src) {
@@ -25,14 +25,14 @@ Display::~Display() {
     SDL_Quit();
 }
 
-void Display::update_display(Uint32 *framebuffer) {
+void Display::update_display(const Uint32 *framebuffer) {
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0xFF);
     SDL_RenderClear(renderer);
 
     int pitch;
     Uint32 *pixels;
     SDL_LockTexture(screen, nullptr, (void **) &pixels, &pitch);
-    memcpy((void *) pixels, (void *) framebuffer, 144 * pitch);
+    memcpy((void *) pixels, (const void *) framebuffer, 144 * pitch);
     SDL_UnlockTexture(screen);
 
     SDL_RenderCopy(renderer, screen, nullptr, nullptr);
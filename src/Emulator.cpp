@@ -0,0 +1,116 @@
+//
+// Created by antonio on 17/10/26.
+//
+
+#include "Emulator.h"
+
+#include <bit>
+#include <chrono>
+
+#include "Audio.h"
+
+namespace {
+    // Enough for a couple of minutes of history in most games
+    const size_t rewind_budget = 64 << 20;
+}
+
+Emulator::Emulator(Audio &audio) : audio(audio), quit(false), keys(0), rewinding(false),
+                                   rewind_buffer(rewind_budget), run_ahead(0), shown(0), dropped(0),
+                                   last_sequence(0) {}
+
+Emulator::~Emulator() {
+    stop();
+}
+
+void Emulator::start(std::unique_ptr<gb::Gameboy> new_gb) {
+    stop();
+    gb = std::move(new_gb);
+    rewind_buffer.clear();
+    shown = dropped = last_sequence = 0;
+    {
+        std::lock_guard<std::mutex> lock(commands_mutex);
+        commands.clear();
+    }
+    quit.store(false, std::memory_order_relaxed);
+    thread = std::thread(&Emulator::run, this);
+}
+
+void Emulator::stop() {
+    if ( !thread.joinable() )
+        return;
+    quit.store(true, std::memory_order_relaxed);
+    thread.join();
+}
+
+void Emulator::post(Command command) {
+    std::lock_guard<std::mutex> lock(commands_mutex);
+    commands.push_back(std::move(command));
+}
+
+void Emulator::run() {
+    // Frames are paced by the emulated frame rate, audio follows through the rate control
+    using frame_clock = std::chrono::steady_clock;
+    const auto frame_period = std::chrono::duration_cast<frame_clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(gb::Gameboy::frame_cycles) / gb::cpu::clock_speed));
+    auto next_frame = frame_clock::now();
+    // Emulated frames owed at the current speed, fractions carry over to the next host frame
+    double frame_credit = 0;
+    uint8_t applied_keys = 0;
+
+    while ( !quit.load(std::memory_order_relaxed) ) {
+        run_commands();
+        apply_keys(applied_keys);
+
+        if ( rewinding.load(std::memory_order_relaxed) ) {
+            if ( rewind_buffer.rewind(*gb) )
+                gb->publish_frame();
+        } else if ( !gb->is_paused() ) {
+            gb->set_audio_rate(audio.producer_rate());
+            for ( frame_credit += gb->speed() / 10.0; frame_credit >= 1; frame_credit -= 1 ) {
+                run_ahead.run_frame(*gb);
+                audio.push(run_ahead.audio().data(), run_ahead.audio().size() / 2);
+                rewind_buffer.capture(*gb);
+            }
+        }
+
+        next_frame += frame_period;
+        auto now = frame_clock::now();
+        // Too far behind to catch up (the machine was suspended, the host is too slow), start over from now
+        if ( now > next_frame + 4 * frame_period )
+            next_frame = now;
+        else
+            std::this_thread::sleep_until(next_frame);
+    }
+}
+
+bool Emulator::new_frame() {
+    if ( !gb || !gb->acquire_frame() )
+        return false;
+    uint64_t sequence = gb->frame_sequence();
+    dropped += sequence - last_sequence - 1;
+    last_sequence = sequence;
+    shown++;
+    return true;
+}
+
+void Emulator::run_commands() {
+    {
+        std::lock_guard<std::mutex> lock(commands_mutex);
+        pending.swap(commands);
+    }
+    for ( auto &command : pending )
+        command(*gb);
+    pending.clear();
+}
+
+void Emulator::apply_keys(uint8_t &applied) {
+    uint8_t held = keys.load(std::memory_order_relaxed);
+    for ( uint8_t changed = held ^ applied; changed != 0; changed &= changed - 1 ) {
+        auto key = static_cast<Joypad::key_e>(std::countr_zero(changed));
+        if ( held & (1u << key) )
+            gb->press_key(key);
+        else
+            gb->release_key(key);
+    }
+    applied = held;
+}
@@ -3,3 +3,48 @@
 //
 
 #include "Logger/Logger.h"
+
+#include <atomic>
+#include <iostream>
+
+namespace {
+    std::atomic<Logger::Sink> sink = nullptr;
+    std::atomic<bool> enable_info = false;
+    std::atomic<bool> enable_warning = false;
+
+    void log(Logger::Level level, const std::string& section, const std::string& message) {
+        if ( auto s = sink.load(std::memory_order_relaxed) )
+            s(level, section, message);
+    }
+}
+
+void Logger::set_sink(Sink s) {
+    sink = s;
+}
+
+void Logger::stdout_sink(Level level, const std::string& section, const std::string& message) {
+    const char *tag = level == Level::info ? "[+]" : level == Level::error ? "[-]" : "[!]";
+    std::cout << tag << "[" << section << "] - " << message << std::endl;
+}
+
+void Logger::info(const std::string& section, const std::string& message) {
+    if ( enable_info )
+        log(Level::info, section, message);
+}
+
+void Logger::error(const std::string& section, const std::string& message) {
+    if ( enable_warning )
+        log(Level::error, section, message);
+}
+
+void Logger::warning(const std::string& section, const std::string& message) {
+    log(Level::warning, section, message);
+}
+
+void Logger::toggle_info() {
+    enable_info = !enable_info;
+}
+
+void Logger::toggle_warning() {
+    enable_warning = !enable_warning;
+}
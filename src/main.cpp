@@ -1,110 +1,144 @@
+#include <cstdio>
 #include <iostream>
 #include <SDL2/SDL.h>
 
 #include <Audio.h>
 #include <Display.h>
+#include <Emulator.h>
 #include <Core/Gameboy.h>
 #include <Core/Joypad.h>
 #include <Logger/Logger.h>
 #include <filesystem>
 #include <map>
 #include <functional>
-#include <thread>
 
 namespace {
-    void key_down(std::unique_ptr<gb::Gameboy> &gb, SDL_Keycode key) {
-        if ( not gb )
+    // Frames run ahead of the one shown, cycled through with F
+    const unsigned int max_run_ahead = 3;
+
+    const std::map<SDL_Keycode, Joypad::key_e> joypad_keys = {
+            {SDLK_a, Joypad::KEY_A},
+            {SDLK_s, Joypad::KEY_B},
+            {SDLK_UP, Joypad::KEY_UP},
+            {SDLK_DOWN, Joypad::KEY_DOWN},
+            {SDLK_LEFT, Joypad::KEY_LEFT},
+            {SDLK_RIGHT, Joypad::KEY_RIGHT},
+            {SDLK_x, Joypad::KEY_SELECT},
+            {SDLK_z, Joypad::KEY_START}
+    };
+
+    void key_down(Emulator &emulator, Audio &audio, SDL_Keycode key) {
+        if ( not emulator.running() )
             return;
-        static std::map<SDL_Keycode, std::function<void(void)>> key_callbacks = {
-                {SDLK_1, [&gb] { gb->disable_bg(); }},
-                {SDLK_2, [&gb] { gb->disable_window(); }},
-                {SDLK_3, [&gb] { gb->disable_sprites(); }},
-                {SDLK_4, [&gb] { gb->toggle_ch1(); }},
-                {SDLK_5, [&gb] { gb->toggle_ch2(); }},
-                {SDLK_6, [&gb] { gb->toggle_wave(); }},
-                {SDLK_7, [&gb] { gb->toggle_noise(); }},
-                {SDLK_8, [&gb] { gb->set_speed(15); }},
-                {SDLK_9, [&gb] { gb->set_speed(20); }},
-                {SDLK_0, [&gb] { gb->set_speed(40); }},
-                {SDLK_COMMA, [&gb] { gb->set_speed(1); }},
-                {SDLK_p, [&gb] { gb->toggle_pause(); }},
-                {SDLK_a, [&gb] { gb->press_key(Joypad::KEY_A); }},
-                {SDLK_s, [&gb] { gb->press_key(Joypad::KEY_B); }},
-                {SDLK_UP, [&gb] { gb->press_key(Joypad::KEY_UP); }},
-                {SDLK_DOWN, [&gb] { gb->press_key(Joypad::KEY_DOWN); }},
-                {SDLK_LEFT, [&gb] { gb->press_key(Joypad::KEY_LEFT); }},
-                {SDLK_RIGHT, [&gb] { gb->press_key(Joypad::KEY_RIGHT); }},
-                {SDLK_x, [&gb] { gb->press_key(Joypad::KEY_SELECT); }},
-                {SDLK_z, [&gb] { gb->press_key(Joypad::KEY_START); }}
+        // Run on the emulation thread, which owns the Gameboy along with the rewind history and run-ahead
+        static std::map<SDL_Keycode, Emulator::Command> key_callbacks = {
+                {SDLK_1, [](gb::Gameboy &gb) { gb.disable_bg(); }},
+                {SDLK_2, [](gb::Gameboy &gb) { gb.disable_window(); }},
+                {SDLK_3, [](gb::Gameboy &gb) { gb.disable_sprites(); }},
+                {SDLK_4, [](gb::Gameboy &gb) { gb.toggle_ch1(); }},
+                {SDLK_5, [](gb::Gameboy &gb) { gb.toggle_ch2(); }},
+                {SDLK_6, [](gb::Gameboy &gb) { gb.toggle_wave(); }},
+                {SDLK_7, [](gb::Gameboy &gb) { gb.toggle_noise(); }},
+                {SDLK_8, [](gb::Gameboy &gb) { gb.set_speed(15); }},
+                {SDLK_9, [](gb::Gameboy &gb) { gb.set_speed(20); }},
+                {SDLK_0, [](gb::Gameboy &gb) { gb.set_speed(40); }},
+                {SDLK_COMMA, [](gb::Gameboy &gb) { gb.set_speed(1); }},
+                {SDLK_p, [](gb::Gameboy &gb) { gb.toggle_pause(); }},
+                {SDLK_j, [](gb::Gameboy &gb) {
+                    gb.toggle_jit();
+                    std::cout << "Recompiler: " << (gb.jit_enabled() ? "on" : "off") << std::endl;
+                }},
+                {SDLK_i, [&emulator, &audio](gb::Gameboy &gb) {
+                    std::cout << "Frames: " << gb.frames_published() << " published" << std::endl;
+                    const auto &stats = gb.idle_loop_stats();
+                    std::cout << "Idle loops skipped: " << stats.hits << " (" << stats.cycles << " cycles)" << std::endl;
+                    if ( gb.jit_enabled() ) {
+                        const auto &jit = gb.jit_stats();
+                        std::cout << "Native runs: " << jit.runs << " (" << jit.instructions << " instructions)" << std::endl;
+                    }
+                    const auto &rewind_buffer = emulator.get_rewind_buffer();
+                    const auto &rewind = rewind_buffer.capture_stats();
+                    if ( rewind.captures > 0 )
+                        std::cout << "Rewind: " << rewind_buffer.seconds() << "s in " << (rewind_buffer.memory_used() >> 10)
+                                  << " KiB, capture " << rewind.total_ns / rewind.captures / 1000 << "us avg, "
+                                  << rewind.last_ns / 1000 << "us last" << std::endl;
+                    const auto &run_ahead = emulator.get_run_ahead();
+                    const auto &ahead = run_ahead.stats();
+                    if ( run_ahead.frames() > 0 && ahead.frames > 0 )
+                        std::cout << "Run-ahead: " << run_ahead.frames() << " frames, " << ahead.real_ns / ahead.frames / 1000
+                                  << "us per real frame, " << ahead.ahead_ns / ahead.frames / 1000 << "us ahead ("
+                                  << run_ahead.overhead() * 100 << "% overhead)" << std::endl;
+                    std::cout << "Audio: ring " << audio.fill() * 100 << "% full, " << audio.underruns() << " underruns"
+                              << std::endl;
+                }},
+                {SDLK_f, [&emulator](gb::Gameboy &) {
+                    auto &run_ahead = emulator.get_run_ahead();
+                    run_ahead.set_frames((run_ahead.frames() + 1) % (max_run_ahead + 1));
+                    std::cout << "Run-ahead: " << run_ahead.frames() << " frames" << std::endl;
+                }}
         };
 
-        try {
-            key_callbacks.at(key)();
-        } catch (std::out_of_range &e) {
+        if ( auto joypad_key = joypad_keys.find(key); joypad_key != joypad_keys.end() )
+            emulator.press(joypad_key->second);
+        else if ( key == SDLK_r )
+            emulator.set_rewinding(true);
+        else if ( auto callback = key_callbacks.find(key); callback != key_callbacks.end() ) {
+            // What was shown is only known here, the rest of the stats on the emulation thread
+            if ( key == SDLK_i )
+                std::cout << "Display: " << emulator.frames_shown() << " frames shown, " << emulator.frames_dropped()
+                          << " dropped" << std::endl;
+            emulator.post(callback->second);
+        } else
             Logger::warning("Input", "Unknown keycode");
-        }
     }
 
-    void key_up(std::unique_ptr<gb::Gameboy> &gb, SDL_Keycode key) {
-        if (not gb)
+    void key_up(Emulator &emulator, SDL_Keycode key) {
+        if ( not emulator.running() )
             return;
-        static std::map<SDL_Keycode, std::function<void(void)>> key_callbacks = {
-                {SDLK_a, [&gb] { gb->release_key(Joypad::KEY_A); }},
-                {SDLK_s, [&gb] { gb->release_key(Joypad::KEY_B); }},
-                {SDLK_UP, [&gb] { gb->release_key(Joypad::KEY_UP); }},
-                {SDLK_DOWN, [&gb] { gb->release_key(Joypad::KEY_DOWN); }},
-                {SDLK_LEFT, [&gb] { gb->release_key(Joypad::KEY_LEFT); }},
-                {SDLK_RIGHT, [&gb] { gb->release_key(Joypad::KEY_RIGHT); }},
-                {SDLK_x, [&gb] { gb->release_key(Joypad::KEY_SELECT); }},
-                {SDLK_z, [&gb] { gb->release_key(Joypad::KEY_START); }}
-        };
-        try {
-            key_callbacks.at(key)();
-        } catch (std::out_of_range &e) {
+        if ( auto joypad_key = joypad_keys.find(key); joypad_key != joypad_keys.end() )
+            emulator.release(joypad_key->second);
+        else if ( key == SDLK_r )
+            emulator.set_rewinding(false);
+        else
             Logger::warning("Input", "Unknown key");
-        }
     }
 }
 
 int main() {
     static std::map<Uint32, std::function<void(void)>> event_callbacks;
 
-    Logger::toggle_info();
-    std::unique_ptr<gb::Gameboy> gb(nullptr);
+    Logger::set_sink(Logger::stdout_sink);
 
     Display display{};
     Audio audio{};
+    // Emulation runs on its own thread, this one only handles input and presents the frames it finishes
+    Emulator emulator{audio};
 
     display.clear();
-    std::chrono::system_clock::time_point a = std::chrono::system_clock::now();
-    std::chrono::system_clock::time_point b = std::chrono::system_clock::now();
 
     bool close = false;
     while ( not close ) {
-        a = std::chrono::system_clock::now();
-        auto work_time = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(a - b);
-        b = a;
         SDL_Event e;
-        while ( (not close) and SDL_PollEvent(&e) ) {
+        // Wakes up as soon as there's input, and often enough for finished frames not to wait long to be shown
+        for ( bool pending = SDL_WaitEventTimeout(&e, 1); (not close) and pending; pending = SDL_PollEvent(&e) ) {
             if ( e.type == SDL_DROPFILE ) {
                 std::filesystem::path game_path{e.drop.file};
-                if ( gb ) {
-                    display.clear();
-                } else {
+                if ( not emulator.running() )
                     display.set_title("OhBoi");
-                    display.clear();
-                }
-                gb = std::make_unique<gb::Gameboy>(game_path);
+                display.clear();
+                auto gameboy = std::make_unique<gb::Gameboy>(game_path);
+                gameboy->set_serial_sink([](uint8_t byte) { std::printf("%x ", byte); });
+                emulator.start(std::move(gameboy));
                 event_callbacks.clear();
                 event_callbacks = {
                         {SDL_QUIT, [&close] {
                             close = true;
                         }},
-                        {SDL_KEYDOWN, [&gb, &e] {
-                            ::key_down(gb, e.key.keysym.sym);
+                        {SDL_KEYDOWN, [&emulator, &audio, &e] {
+                            ::key_down(emulator, audio, e.key.keysym.sym);
                         }},
-                        { SDL_KEYUP, [&gb, &e] {
-                            ::key_up(gb, e.key.keysym.sym);
+                        { SDL_KEYUP, [&emulator, &e] {
+                            ::key_up(emulator, e.key.keysym.sym);
                         }}
                 };
                 continue;
@@ -116,24 +150,9 @@ int main() {
                 }
             }
         }
-        if ( gb ) {
-            gb->reset_cpu_cycle_counter();
-            bool rendered_ = false;
-            while ( gb->get_cpu_cycles() < (gb::cpu::clock_speed / 60) ) {
-                gb->step();
-                if ( gb->new_audio_available() ) {
-                    gb->set_audio_reproduced();
-                    audio.update(gb->get_audio_output());
-                }
-                if ( !rendered_ && gb->is_in_vblank() ) {
-                    display.update_display(gb->get_screen());
-                    rendered_ = true;
-                }
-            }
-        }
-        if ( work_time.count() < 1000.0/59.73 ) {
-            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(1000.0/59.73 - work_time.count()));
-        }
+        if ( emulator.new_frame() )
+            display.update_display(emulator.frame());
     }
+    emulator.stop();
     return 0;
-}
\ No newline at end of file
+}